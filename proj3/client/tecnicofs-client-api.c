@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <stdio.h>
 
 int sockfd;
@@ -11,24 +12,73 @@ socklen_t clilen, servlen;
 struct sockaddr_un cli_addr, serv_addr;
 
 /*
- * Sends the command to the server
+ * Sends a request to the server and waits for its reply. The command takes
+ * the first MAX_INPUT_SIZE bytes of the request and data follows it, the
+ * reply is the result followed by data, and may carry a descriptor.
  * Inputs:
  *   - command
+ *   - data: data to send, or NULL
+ *   - len: length of data, at most MAX_IO_SIZE
+ *   - reply: receives the data of the reply, or NULL
+ *   - reply_len: size of reply
+ *   - reply_fd: receives the descriptor passed by the server or -1, or
+ *     NULL if none is expected (the kernel then closes it)
+ * Returns:
+ *   - the result of the command or FAIL
  */
-int tfsSend(char *command) {
+static int tfsRequest(char *command, char *data, int len, char *reply, int reply_len, int *reply_fd) {
+  char request[MAX_INPUT_SIZE + MAX_IO_SIZE], response[sizeof(int) + MAX_IO_SIZE];
+  struct iovec iov = { .iov_base = response, .iov_len = sizeof(response) };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+  union {
+    char buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct cmsghdr *cmsg;
   int n, res;
-  if (sendto(sockfd, command, MAX_INPUT_SIZE, 0, (struct sockaddr *)&serv_addr, servlen) != MAX_INPUT_SIZE){ 
+
+  if (reply_fd) {
+    *reply_fd = -1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+  }
+
+  memset(request, 0, MAX_INPUT_SIZE);
+  strncpy(request, command, MAX_INPUT_SIZE - 1);
+  if (len > 0) memcpy(request + MAX_INPUT_SIZE, data, len);
+
+  if (sendto(sockfd, request, MAX_INPUT_SIZE + len, 0, (struct sockaddr *)&serv_addr, servlen) != MAX_INPUT_SIZE + len) {
+    return FAIL;
+  }
+  n = recvmsg(sockfd, &msg, 0);
+  if (reply_fd && n >= 0)
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(reply_fd, CMSG_DATA(cmsg), sizeof(int));
+  if (n < (int) sizeof(int)) {
+    if (reply_fd && *reply_fd >= 0) close(*reply_fd);
     return FAIL;
   }
-  n = recvfrom(sockfd, &res, sizeof(int), 0, 0, 0);
-  if (n < 0) return FAIL;
+  memcpy(&res, response, sizeof(int));
   if (res == ABORT) {
     fprintf(stderr, "Fatal error: server shutdown\n");
     exit(EXIT_FAILURE);
   }
+
+  n -= sizeof(int);
+  if (reply && n > 0) memcpy(reply, response + sizeof(int), n < reply_len ? n : reply_len);
   return res;
 }
 
+/*
+ * Sends the command to the server
+ * Inputs:
+ *   - command
+ */
+int tfsSend(char *command) {
+  return tfsRequest(command, NULL, 0, NULL, 0, NULL);
+}
+
 /*
  * Creates a new node given a path
  * Inputs:
@@ -97,7 +147,159 @@ int tfsPrint(char *outputfile) {
 }
 
 /*
- * Creates the client socket
+ * Prints the server statistics to a file
+ * Inputs:
+ *   - outputfile: file to where the statistics will be printed
+ * Returns:
+ *   - SUCCESS or FAIL
+ */
+int tfsStats(char *outputfile) {
+  char command[MAX_INPUT_SIZE];
+  if (sprintf(command, "s %s", outputfile) <= 0) return FAIL;
+  return tfsSend(command);
+}
+
+/*
+ * Opens a file
+ * Inputs:
+ *   - filename: path of the file
+ *   - mode: READ, WRITE or RW
+ * Returns:
+ *   - a descriptor of the file or an error
+ */
+int tfsOpen(char *filename, permission mode) {
+  char command[MAX_INPUT_SIZE];
+  if (snprintf(command, MAX_INPUT_SIZE, "o %s %d", filename, mode) <= 0) return FAIL;
+  return tfsSend(command);
+}
+
+/*
+ * Closes a file
+ * Inputs:
+ *   - fd: descriptor of the file
+ * Returns:
+ *   - SUCCESS or an error
+ */
+int tfsClose(int fd) {
+  char command[MAX_INPUT_SIZE];
+  if (sprintf(command, "x %d", fd) <= 0) return FAIL;
+  return tfsSend(command);
+}
+
+/*
+ * Reads from a file, continuing where the last read or write on the
+ * descriptor ended. Requests carry at most MAX_IO_SIZE bytes each.
+ * Inputs:
+ *   - fd: descriptor of the file
+ *   - buffer: receives the data
+ *   - len: maximum number of bytes to read
+ * Returns:
+ *   - the number of bytes read, less than len at the end of the file, or
+ *     an error
+ */
+int tfsRead(int fd, char *buffer, int len) {
+  char command[MAX_INPUT_SIZE];
+  int res, total = 0;
+
+  while (total < len) {
+    int chunk = len - total < MAX_IO_SIZE ? len - total : MAX_IO_SIZE;
+    if (sprintf(command, "r %d %d", fd, chunk) <= 0) return FAIL;
+    if ((res = tfsRequest(command, NULL, 0, buffer + total, chunk, NULL)) < 0) return res;
+    total += res;
+    if (res < chunk) break;
+  }
+  return total;
+}
+
+/*
+ * Writes to a file, continuing where the last read or write on the
+ * descriptor ended. Requests carry at most MAX_IO_SIZE bytes each, and
+ * writing stops at the first one the server writes only part of.
+ * Inputs:
+ *   - fd: descriptor of the file
+ *   - buffer: data to write
+ *   - len: number of bytes to write
+ * Returns:
+ *   - the number of bytes written or an error
+ */
+int tfsWrite(int fd, char *buffer, int len) {
+  char command[MAX_INPUT_SIZE];
+  int res, total = 0;
+
+  while (total < len) {
+    int chunk = len - total < MAX_IO_SIZE ? len - total : MAX_IO_SIZE;
+    if (sprintf(command, "w %d", fd) <= 0) return FAIL;
+    if ((res = tfsRequest(command, buffer + total, chunk, NULL, 0, NULL)) < 0) return res;
+    total += res;
+    /* the file can't grow any further */
+    if (res < chunk) break;
+  }
+  return total;
+}
+
+/*
+ * Changes the size of a file, shrinking frees the data past the new size
+ * and growing leaves a hole that reads as zeros
+ * Inputs:
+ *   - fd: descriptor of the file, open for writing
+ *   - size: new size
+ * Returns:
+ *   - SUCCESS or an error
+ */
+int tfsTruncate(int fd, int size) {
+  char command[MAX_INPUT_SIZE];
+  if (sprintf(command, "t %d %d", fd, size) <= 0) return FAIL;
+  return tfsSend(command);
+}
+
+/*
+ * Maps the whole contents of a file, without copying them through the
+ * socket: the server passes a sealed, read-only memfd with a snapshot of
+ * the file, which stays as it was when mapped even if the file changes.
+ * The offset of the descriptor doesn't change.
+ * Inputs:
+ *   - fd: descriptor of the file, open for reading
+ *   - data: receives the address of the contents, NULL if the file is
+ *     empty
+ * Returns:
+ *   - the size of the file or an error
+ */
+int tfsMap(int fd, char **data) {
+  char command[MAX_INPUT_SIZE];
+  int res, memfd;
+
+  *data = NULL;
+  if (sprintf(command, "g %d", fd) <= 0) return FAIL;
+  if ((res = tfsRequest(command, NULL, 0, NULL, 0, &memfd)) < 0) {
+    if (memfd >= 0) close(memfd);
+    return res;
+  }
+  if (memfd < 0) return FAIL;
+
+  /* the mapping keeps the snapshot alive once its descriptor is closed */
+  if (res > 0 && (*data = mmap(NULL, res, PROT_READ, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+    *data = NULL;
+    res = FAIL;
+  }
+  close(memfd);
+  return res;
+}
+
+/*
+ * Unmaps the contents of a file mapped with tfsMap
+ * Inputs:
+ *   - data: address returned by tfsMap
+ *   - size: size returned by tfsMap
+ * Returns:
+ *   - SUCCESS or FAIL
+ */
+int tfsUnmap(char *data, int size) {
+  if (data && munmap(data, size) != 0) return FAIL;
+  return SUCCESS;
+}
+
+/*
+ * Creates the client socket and starts a new session on the server
  * Inputs:
  *   - path of the socket
  * Returns:
@@ -118,6 +320,9 @@ int tfsMount(char * sockPath) {
   serv_addr.sun_family = AF_UNIX;
   strcpy(serv_addr.sun_path, sockPath);
   servlen = sizeof(serv_addr.sun_family) + strlen(serv_addr.sun_path);
+
+  /* files an earlier client with the same socket name left open are closed */
+  if (tfsSend("n") != SUCCESS) return FAIL;
   return SUCCESS;
 }
 
@@ -127,6 +332,8 @@ int tfsMount(char * sockPath) {
  *   - SUCCESS or FAIL
  */
 int tfsUnmount() {
+  /* the server closes the files left open */
+  tfsSend("u");
   close(sockfd);
   if (unlink(cli_addr.sun_path) != 0) return FAIL;
   return SUCCESS;
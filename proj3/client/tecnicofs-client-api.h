@@ -13,6 +13,14 @@ int tfsDelete(char *path);
 int tfsLookup(char *path);
 int tfsMove(char *from, char *to);
 int tfsPrint(char *outputfile);
+int tfsStats(char *outputfile);
+int tfsOpen(char *filename, permission mode);
+int tfsClose(int fd);
+int tfsRead(int fd, char *buffer, int len);
+int tfsWrite(int fd, char *buffer, int len);
+int tfsTruncate(int fd, int size);
+int tfsMap(int fd, char **data);
+int tfsUnmap(char *data, int size);
 int tfsMount(char* serverName);
 int tfsUnmount();
 
@@ -103,6 +103,10 @@ void *processInput() {
                 res = tfsPrint(arg1);
                 printf("Tecnicofs tree printed to %s\n", arg1);
                 break;
+            case 's':
+                res = tfsStats(arg1);
+                printf("Tecnicofs stats printed to %s\n", arg1);
+                break;
             case '#':
                 break;
             default: { /* error */
@@ -0,0 +1,1210 @@
+/*
+ * Microbenchmarks for the TecnicoFS server internals.
+ * Built with DELAY=0 (see Makefile) so that insert_delay doesn't hide the
+ * cost of the code being measured.
+ * Usage: ./bench benchmark [maxthreads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "fs/operations.h"
+#include "client/tecnicofs-client-api.h"
+
+/* used in conversion between seconds and microseconds (1 sec = 10e6 usec) */
+#define CONVERSION 1000000
+#define DEFAULT_MAX_THREADS 8
+
+#define CREATE_OPS 200000
+#define CREATE_BATCH 64
+
+#define COUPLING_OPS 100000
+
+#define BRLOCK_OPS 1000000
+#define BRLOCK_WRITE_EVERY 100
+
+#define SAMEDIR_OPS 100000
+#define SAMEDIR_FILES 16
+
+#define CROSS_OPS 100000
+
+#define RENAME_OPS 100000
+#define RENAME_DEPTH 8
+
+#define DISJOINT_OPS 100000
+
+/* workloads replayed by the locks benchmark */
+#define INPUTS_DIR "../../proj2/inputs"
+#define INPUTS_FILES 6
+#define MAX_INPUT_LINES 1024
+#define MAX_LINE_SIZE 100
+#define REPLAY_ROUNDS 500
+
+/* inputs replayed by the layout benchmark, the most lookup heavy ones */
+#define LAYOUT_INPUTS {3, 6}
+
+/* time each thread replays before the alloc benchmark starts counting, long
+ * enough for the reclaim backlog to reach its usual size */
+#define ALLOC_WARMUP_US 200000
+
+/* million-entry tree of the names benchmark, and passes over it */
+#define NAMES_DIRS 1000
+#define NAMES_FILES 1000
+#define NAMES_SCANS 5
+
+/* directory sizes swept by the dirscan benchmark, and lookups per size */
+#define DIRSCAN_SIZES {1, 2, 4, 8, 16, 64, 256}
+#define DIRSCAN_OPS 2000000
+
+/* i-node capacities the startup benchmark initializes the server with,
+ * and files created right after */
+#define STARTUP_CAPACITIES {1 << 20, 10000000, 1 << 26}
+#define STARTUP_FILES 100000
+
+/* file sizes of the files benchmark, bytes moved per measurement and size
+ * of the random reads and writes */
+#define FILES_SIZES {4L << 10, 64L << 10, 1L << 20, 16L << 20, 256L << 20, 1L << 30}
+#define FILES_BYTES (256L << 20)
+#define FILES_RANDOM_IO 4096
+
+/* region of the file each thread of the ranges benchmark writes, and how
+ * many times it writes it */
+#define RANGES_REGION (1L << 20)
+#define RANGES_ROUNDS 256
+
+/* bytes each thread appends in the append benchmark */
+#define APPEND_BYTES (64L << 20)
+
+/* file sizes of the map benchmark, read by a client of a server process
+ * started from SERVER_PATH */
+#define MAP_SIZES {1L << 20, 16L << 20, 128L << 20, 1L << 30}
+#define SERVER_PATH "./server"
+#define SERVER_START_US 5000000
+
+typedef struct benchThread {
+    pthread_t tid;
+    int id;
+    int nthreads;
+    void *arg;
+} BenchThread;
+
+typedef struct benchmark {
+    char *name;
+    char *description;
+    void (*run)(int maxThreads);
+} Benchmark;
+
+/*
+ * Runs a worker function in nthreads threads and waits for all of them.
+ * Input:
+ *   - nthreads: number of threads
+ *   - worker: function run by each thread, receives its BenchThread
+ *   - arg: argument shared by all threads
+ * Returns:
+ *   - elapsed time in seconds
+ */
+double run_threads(int nthreads, void *(*worker)(void*), void *arg) {
+    struct timeval start, end;
+    BenchThread *threads = malloc(nthreads * sizeof(BenchThread));
+
+    if (threads == NULL) {
+        fprintf(stderr, "Error: thread array allocation failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gettimeofday(&start, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].id = i;
+        threads[i].nthreads = nthreads;
+        threads[i].arg = arg;
+        if (pthread_create(&threads[i].tid, NULL, worker, &threads[i]) != 0) {
+            fprintf(stderr, "Error: Thread creation failed.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < nthreads; i++)
+        if (pthread_join(threads[i].tid, NULL) != 0) {
+            fprintf(stderr, "Error: Thread joining failed.\n");
+            exit(EXIT_FAILURE);
+        }
+
+    gettimeofday(&end, NULL);
+    free(threads);
+
+    return ((end.tv_sec - start.tv_sec) * CONVERSION + (end.tv_usec - start.tv_usec)) / (double)CONVERSION;
+}
+
+/*
+ * Creates and deletes i-nodes in batches, so that deleted slots are reused.
+ */
+void *create_worker(void *arg) {
+    BenchThread *self = arg;
+    int ops = CREATE_OPS / self->nthreads;
+    int batch[CREATE_BATCH];
+
+    for (int done = 0; done < ops; done += CREATE_BATCH) {
+        for (int i = 0; i < CREATE_BATCH; i++) {
+            if ((batch[i] = inode_create(T_FILE)) < 0) {
+                fprintf(stderr, "Error: inode_create failed\n");
+                exit(EXIT_FAILURE);
+            }
+            inode_unlock(batch[i]);
+        }
+        for (int i = 0; i < CREATE_BATCH; i++)
+            inode_delete(batch[i]);
+    }
+    return NULL;
+}
+
+void bench_create(int maxThreads) {
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        init_fs();
+        double secs = run_threads(n, create_worker, NULL);
+        printf("threads=%-3d inode_create+delete: %10.0f ops/s (%d i-nodes in table)\n",
+               n, 2 * (CREATE_OPS / n / CREATE_BATCH * CREATE_BATCH * n) / secs, inode_table_size());
+        destroy_fs();
+    }
+}
+
+static int deep_running;
+static unsigned long shallow_ops, shallow_wait_us, shallow_max_us;
+
+static unsigned long now_us() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * CONVERSION + tv.tv_usec;
+}
+
+/*
+ * Thread 0 creates and deletes entries of /a, timing how long each
+ * operation takes, while the others do the same deep inside /a/b/c/d.
+ * Without lock coupling the deep operations keep /a read locked for their
+ * whole duration, so the writer on /a waits for them.
+ */
+void *coupling_worker(void *arg) {
+    BenchThread *self = arg;
+    char path[MAX_FILE_NAME];
+
+    if (self->id == 0) {
+        for (unsigned long i = 0; __atomic_load_n(&deep_running, __ATOMIC_ACQUIRE) > 0; i++) {
+            unsigned long start = now_us();
+            sprintf(path, "/a/s%lu", i % 16);
+            if (create(path, T_FILE) == SUCCESS)
+                delete(path);
+            unsigned long us = now_us() - start;
+            shallow_ops++;
+            shallow_wait_us += us;
+            if (us > shallow_max_us)
+                shallow_max_us = us;
+        }
+        return NULL;
+    }
+
+    for (int i = 0; i < COUPLING_OPS / (self->nthreads - 1); i++) {
+        sprintf(path, "/a/b/c/d/t%d_%d", self->id, i % 16);
+        if (create(path, T_FILE) == SUCCESS)
+            delete(path);
+    }
+    __atomic_fetch_sub(&deep_running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void bench_coupling(int maxThreads) {
+    char *dirs[] = {"/a", "/a/b", "/a/b/c", "/a/b/c/d"};
+
+    for (int coupling = FALSE; coupling <= TRUE; coupling++)
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            set_lock_coupling(coupling);
+            init_fs();
+            for (int i = 0; i < 4; i++)
+                create(dirs[i], T_DIRECTORY);
+            deep_running = n;
+            shallow_ops = shallow_wait_us = shallow_max_us = 0;
+
+            double secs = run_threads(n + 1, coupling_worker, NULL);
+            printf("coupling=%-3s threads=%-3d deep: %9.0f ops/s  writer on /a: %8lu ops, avg %6.1f us, max %6lu us\n",
+                   coupling ? "on" : "off", n, 2 * (COUPLING_OPS / n * n) / secs, shallow_ops,
+                   shallow_ops ? (double)shallow_wait_us / shallow_ops : 0.0, shallow_max_us);
+            destroy_fs();
+        }
+    set_lock_coupling(TRUE);
+}
+
+/*
+ * Lookup-heavy workload on the root: read locks it to look up an entry,
+ * and once every BRLOCK_WRITE_EVERY operations creates and deletes a file
+ * in it. The lookup writes nothing shared (see directory_lookup), so the
+ * root's lock is the only contended write of a read.
+ */
+void *brlock_worker(void *arg) {
+    BenchThread *self = arg;
+    char path[MAX_FILE_NAME];
+    type nType;
+    union Data data;
+
+    sprintf(path, "/w%d", self->id);
+    for (int i = 0; i < BRLOCK_OPS / self->nthreads; i++) {
+        if (i % BRLOCK_WRITE_EVERY == 0) {
+            if (create(path, T_FILE) == SUCCESS)
+                delete(path);
+            continue;
+        }
+        inode_rdlock(FS_ROOT);
+        inode_get(FS_ROOT, &nType, &data);
+        directory_lookup(data.dir, "d");
+        inode_unlock(FS_ROOT);
+    }
+    return NULL;
+}
+
+void bench_brlock(int maxThreads) {
+    for (int enabled = FALSE; enabled <= TRUE; enabled++)
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            inode_set_brlock_enabled(enabled);
+            init_fs();
+            create("/d", T_DIRECTORY);
+            double secs = run_threads(n, brlock_worker, NULL);
+            printf("root lock=%-7s threads=%-3d %10.0f ops/s\n", enabled ? "brlock" : "rwlock",
+                   n, (BRLOCK_OPS / n * n) / secs);
+            destroy_fs();
+        }
+    inode_set_brlock_enabled(TRUE);
+}
+
+/*
+ * Every thread creates and deletes its own files in the same directory,
+ * which only contend on the stripe locks of the names.
+ */
+void *samedir_worker(void *arg) {
+    BenchThread *self = arg;
+    char path[MAX_FILE_NAME];
+
+    for (int i = 0; i < SAMEDIR_OPS / self->nthreads; i++) {
+        sprintf(path, "/d/t%d_%d", self->id, i % SAMEDIR_FILES);
+        if (create(path, T_FILE) == SUCCESS)
+            delete(path);
+    }
+    return NULL;
+}
+
+void bench_samedir(int maxThreads) {
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        init_fs();
+        create("/d", T_DIRECTORY);
+        double secs = run_threads(n, samedir_worker, NULL);
+        printf("threads=%-3d create/delete in one directory: %10.0f ops/s\n",
+               n, 2 * (SAMEDIR_OPS / n * n) / secs);
+        destroy_fs();
+    }
+}
+
+/*
+ * Half of the threads move files from /x to /y and back, the other half
+ * from /y to /x and back, so their lock sets keep overlapping in
+ * opposite path orders.
+ */
+void *cross_worker(void *arg) {
+    BenchThread *self = arg;
+    char *dirs[] = {"/x", "/y"};
+    char from[MAX_FILE_NAME], to[MAX_FILE_NAME];
+    int side = self->id % 2;
+
+    for (int i = 0; i < CROSS_OPS / self->nthreads; i++) {
+        sprintf(from, "%s/f%d", dirs[(side + i) % 2], self->id);
+        sprintf(to, "%s/f%d", dirs[(side + i + 1) % 2], self->id);
+        move(from, to);
+    }
+    return NULL;
+}
+
+void bench_cross(int maxThreads) {
+    char path[MAX_FILE_NAME];
+
+    for (int n = 2; n <= maxThreads; n *= 2) {
+        init_fs();
+        create("/x", T_DIRECTORY);
+        create("/y", T_DIRECTORY);
+        for (int i = 0; i < n; i++) {
+            sprintf(path, "%s/f%d", i % 2 ? "/y" : "/x", i);
+            create(path, T_FILE);
+        }
+        unsigned long tries = stats_get(STAT_LOCKSET_TRY);
+        unsigned long backoffs = stats_get(STAT_LOCKSET_BACKOFF);
+        double secs = run_threads(n, cross_worker, NULL);
+        printf("threads=%-3d %9.0f moves/s, %lu locks out of order, %lu back-offs\n",
+               n, (CROSS_OPS / n * n) / secs, stats_get(STAT_LOCKSET_TRY) - tries,
+               stats_get(STAT_LOCKSET_BACKOFF) - backoffs);
+        destroy_fs();
+    }
+}
+
+/*
+ * Each thread moves its file back and forth between two sibling
+ * directories RENAME_DEPTH levels deep, like a build moving its outputs.
+ */
+void *rename_worker(void *arg) {
+    BenchThread *self = arg;
+    char *prefix = self->arg;
+    char from[MAX_FILE_NAME], to[MAX_FILE_NAME];
+
+    for (int i = 0; i < RENAME_OPS / self->nthreads; i++) {
+        sprintf(from, "%s/%s/f%d", prefix, i % 2 ? "out" : "tmp", self->id);
+        sprintf(to, "%s/%s/f%d", prefix, i % 2 ? "tmp" : "out", self->id);
+        move(from, to);
+    }
+    return NULL;
+}
+
+void bench_rename(int maxThreads) {
+    char prefix[MAX_FILE_NAME] = "", path[MAX_FILE_NAME];
+
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        init_fs();
+        prefix[0] = '\0';
+        for (int i = 0; i < RENAME_DEPTH; i++) {
+            sprintf(prefix + strlen(prefix), "/d%d", i);
+            create(prefix, T_DIRECTORY);
+        }
+        sprintf(path, "%s/tmp", prefix);
+        create(path, T_DIRECTORY);
+        sprintf(path, "%s/out", prefix);
+        create(path, T_DIRECTORY);
+        for (int i = 0; i < n; i++) {
+            sprintf(path, "%s/tmp/f%d", prefix, i);
+            create(path, T_FILE);
+        }
+        unsigned long shared = stats_get(STAT_MOVE_SHARED_COMPONENTS);
+        double secs = run_threads(n, rename_worker, prefix);
+        printf("threads=%-3d %9.0f moves/s, %lu shared components walked once\n",
+               n, (RENAME_OPS / n * n) / secs, stats_get(STAT_MOVE_SHARED_COMPONENTS) - shared);
+        destroy_fs();
+    }
+}
+
+/*
+ * Each thread moves its file back and forth between /t<i>/tmp and
+ * /t<i>/out, where i is its id with a separate tree, or 0 with a shared
+ * one. Moves are only validated against the others below the same common
+ * ancestor (see move_aux), so separate trees shouldn't walk again.
+ */
+void *disjoint_worker(void *arg) {
+    BenchThread *self = arg;
+    int tree = *(int*)self->arg ? self->id : 0;
+    char from[MAX_FILE_NAME], to[MAX_FILE_NAME];
+
+    for (int i = 0; i < DISJOINT_OPS / self->nthreads; i++) {
+        sprintf(from, "/t%d/%s/f%d", tree, i % 2 ? "out" : "tmp", self->id);
+        sprintf(to, "/t%d/%s/f%d", tree, i % 2 ? "tmp" : "out", self->id);
+        move(from, to);
+    }
+    return NULL;
+}
+
+void bench_disjoint(int maxThreads) {
+    char path[MAX_FILE_NAME];
+
+    for (int separate = 1; separate >= 0; separate--)
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            init_fs();
+            for (int i = 0; i < (separate ? n : 1); i++) {
+                sprintf(path, "/t%d", i);
+                create(path, T_DIRECTORY);
+                sprintf(path, "/t%d/tmp", i);
+                create(path, T_DIRECTORY);
+                sprintf(path, "/t%d/out", i);
+                create(path, T_DIRECTORY);
+            }
+            for (int i = 0; i < n; i++) {
+                sprintf(path, "/t%d/tmp/f%d", separate ? i : 0, i);
+                create(path, T_FILE);
+            }
+            unsigned long retries = stats_get(STAT_MOVE_RETRY);
+            double secs = run_threads(n, disjoint_worker, &separate);
+            printf("threads=%-3d %-8s trees %9.0f moves/s, %lu walked again\n",
+                   n, separate ? "separate" : "shared", (DISJOINT_OPS / n * n) / secs,
+                   stats_get(STAT_MOVE_RETRY) - retries);
+            destroy_fs();
+        }
+}
+
+typedef struct workload {
+    char commands[MAX_INPUT_LINES][MAX_LINE_SIZE];
+    int count;
+} Workload;
+
+static int saved_stdout, saved_stderr;
+
+/*
+ * Sends what the operations print to /dev/null, so that printing their
+ * errors isn't what gets measured.
+ */
+void quiet_begin() {
+    int null = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    fflush(stderr);
+    saved_stdout = dup(STDOUT_FILENO);
+    saved_stderr = dup(STDERR_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(null);
+}
+
+void quiet_end() {
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stdout);
+    close(saved_stderr);
+}
+
+/*
+ * Reads the commands of an input file, skipping comments.
+ * Returns: SUCCESS or FAIL if the file can't be read
+ */
+int load_workload(char *path, Workload *workload) {
+    FILE *fp = fopen(path, "r");
+    char line[MAX_LINE_SIZE];
+
+    if (fp == NULL)
+        return FAIL;
+    workload->count = 0;
+    while (workload->count < MAX_INPUT_LINES && fgets(line, sizeof(line), fp))
+        if (line[0] != '#' && line[0] != '\n')
+            strcpy(workload->commands[workload->count++], line);
+    fclose(fp);
+    return SUCCESS;
+}
+
+/* applies a command like applyCommand in main.c, without printing */
+void apply_command(char *command) {
+    char token, name[MAX_LINE_SIZE], arg[MAX_LINE_SIZE];
+
+    if (sscanf(command, "%c %s %s", &token, name, arg) < 2)
+        return;
+    switch (token) {
+        case 'c':
+            create(name, arg[0] == 'd' ? T_DIRECTORY : T_FILE);
+            break;
+        case 'l':
+            lookup(name);
+            break;
+        case 'd':
+            delete(name);
+            break;
+        case 'm':
+            move(name, arg);
+            break;
+    }
+}
+
+/*
+ * Replays the whole workload once starting at a given command, resetting
+ * the arena after each command like the server does.
+ */
+void replay_round(Workload *workload, int start) {
+    for (int i = 0; i < workload->count; i++) {
+        apply_command(workload->commands[(start + i) % workload->count]);
+        arena_reset();
+    }
+}
+
+/*
+ * Every thread replays the whole workload REPLAY_ROUNDS times on the same
+ * file system, each one starting at a different command.
+ */
+void *replay_worker(void *arg) {
+    BenchThread *self = arg;
+    Workload *workload = self->arg;
+    int start = self->id * workload->count / self->nthreads;
+
+    for (int round = 0; round < REPLAY_ROUNDS; round++)
+        replay_round(workload, start);
+    return NULL;
+}
+
+/*
+ * Replays every proj2 input file with each value of a startup option.
+ * Input:
+ *   - maxThreads: maximum number of threads
+ *   - option: name of the option, for the output
+ *   - count: number of values of the option
+ *   - name: returns the name of a value
+ *   - set: applies a value, before init_fs
+ *   - reset: value applied at the end
+ */
+void replay_inputs(int maxThreads, char *option, int count, char *(*name)(int), void (*set)(int), int reset) {
+    static Workload workload;
+    char path[MAX_FILE_NAME];
+
+    for (int f = 1; f <= INPUTS_FILES; f++) {
+        sprintf(path, "%s/test%d.txt", INPUTS_DIR, f);
+        if (load_workload(path, &workload) != SUCCESS) {
+            fprintf(stderr, "Error: can't read %s\n", path);
+            continue;
+        }
+        for (int value = 0; value < count; value++) {
+            printf("test%d %s=%-10s", f, option, name(value));
+            for (int n = 1; n <= maxThreads; n *= 2) {
+                set(value);
+                init_fs();
+                quiet_begin();
+                double secs = run_threads(n, replay_worker, &workload);
+                quiet_end();
+                printf(" threads=%d: %8.0f ops/s", n, (double)n * REPLAY_ROUNDS * workload.count / secs);
+                destroy_fs();
+            }
+            printf("\n");
+        }
+    }
+    set(reset);
+}
+
+void bench_locks(int maxThreads) {
+    replay_inputs(maxThreads, "lock", NRWLOCKKINDS, rwlock_kind_name, rwlock_set_kind, RWLOCK_PTHREAD);
+}
+
+void bench_sync(int maxThreads) {
+    replay_inputs(maxThreads, "sync", NSYNCSTRATEGIES, sync_strategy_name, sync_set_strategy, SYNC_OPTIMISTIC);
+}
+
+/* hardware events counted by the layout benchmark */
+static struct {
+    char *name;
+    unsigned int type;
+    unsigned long config;
+} layout_events[] = {
+    {"cache-refs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"L1d-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                       PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                       PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+};
+#define LAYOUT_EVENTS (sizeof(layout_events) / sizeof(layout_events[0]))
+
+/*
+ * Opens a disabled counter of user space events of this thread and of the
+ * threads it creates from now on.
+ * Returns: the counter's file descriptor, or FAIL with errno set
+ */
+int perf_counter_open(unsigned int type, unsigned long config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * Replays the lookup heavy proj2 inputs while counting cache misses, which
+ * is what the layout of the i-node table (see state.h) is meant to reduce.
+ * The events are counted over the whole run, including init_fs.
+ * ./bench_packed runs it with the layout that came before, to compare.
+ */
+void bench_layout(int maxThreads) {
+    static Workload workload;
+    int inputs[] = LAYOUT_INPUTS, fds[LAYOUT_EVENTS];
+    char path[MAX_FILE_NAME];
+
+#ifdef INODE_LAYOUT_PACKED
+    printf("i-node table: packed, one array of whole i-nodes\n");
+#else
+    printf("i-node table: split into lock, type and data arrays\n");
+#endif
+
+    for (int e = 0; e < LAYOUT_EVENTS; e++)
+        if ((fds[e] = perf_counter_open(layout_events[e].type, layout_events[e].config)) < 0)
+            printf("%s: unavailable (%s)\n", layout_events[e].name, strerror(errno));
+
+    for (int f = 0; f < sizeof(inputs) / sizeof(int); f++) {
+        sprintf(path, "%s/test%d.txt", INPUTS_DIR, inputs[f]);
+        if (load_workload(path, &workload) != SUCCESS) {
+            fprintf(stderr, "Error: can't read %s\n", path);
+            continue;
+        }
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            for (int e = 0; e < LAYOUT_EVENTS; e++)
+                if (fds[e] >= 0) {
+                    ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+                    ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+                }
+            init_fs();
+            quiet_begin();
+            double secs = run_threads(n, replay_worker, &workload);
+            quiet_end();
+            destroy_fs();
+
+            double ops = (double)n * REPLAY_ROUNDS * workload.count;
+
+            printf("test%d threads=%-3d %8.0f ops/s", inputs[f], n, ops / secs);
+            for (int e = 0; e < LAYOUT_EVENTS; e++) {
+                unsigned long count;
+
+                if (fds[e] < 0)
+                    continue;
+                ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fds[e], &count, sizeof(count)) == sizeof(count))
+                    printf(" %s/op: %6.2f", layout_events[e].name, count / ops);
+            }
+            printf("\n");
+        }
+    }
+
+    for (int e = 0; e < LAYOUT_EVENTS; e++)
+        if (fds[e] >= 0)
+            close(fds[e]);
+}
+
+static pthread_barrier_t alloc_barrier;
+static unsigned long alloc_system_before, alloc_slab_before;
+
+/*
+ * Replays a workload like replay_worker, after ALLOC_WARMUP_US of rounds
+ * that fill the allocator caches. Thread 0 takes the counters once every
+ * thread is warm.
+ */
+void *alloc_worker(void *arg) {
+    BenchThread *self = arg;
+    Workload *workload = self->arg;
+    int start = self->id * workload->count / self->nthreads;
+    unsigned long warmup_end = now_us() + ALLOC_WARMUP_US;
+
+    while (now_us() < warmup_end)
+        replay_round(workload, start);
+
+    pthread_barrier_wait(&alloc_barrier);
+    if (self->id == 0) {
+        alloc_system_before = stats_get(STAT_SYSTEM_ALLOCS);
+        alloc_slab_before = stats_get(STAT_SLAB_ALLOCS);
+    }
+    pthread_barrier_wait(&alloc_barrier);
+
+    for (int round = 0; round < REPLAY_ROUNDS; round++)
+        replay_round(workload, start);
+    return NULL;
+}
+
+/*
+ * Replays every proj2 input file and reports how often the warm request
+ * path allocates, and how often that reaches the system allocator.
+ */
+void bench_alloc(int maxThreads) {
+    static Workload workload;
+    char path[MAX_FILE_NAME];
+
+    for (int f = 1; f <= INPUTS_FILES; f++) {
+        sprintf(path, "%s/test%d.txt", INPUTS_DIR, f);
+        if (load_workload(path, &workload) != SUCCESS) {
+            fprintf(stderr, "Error: can't read %s\n", path);
+            continue;
+        }
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            if (pthread_barrier_init(&alloc_barrier, NULL, n) != 0) {
+                fprintf(stderr, "Error: failed to initialize barrier\n");
+                exit(EXIT_FAILURE);
+            }
+            init_fs();
+            quiet_begin();
+            run_threads(n, alloc_worker, &workload);
+            quiet_end();
+
+            double ops = (double)n * REPLAY_ROUNDS * workload.count;
+
+            printf("test%d threads=%-3d %6.2f slab allocations/op, %lu system allocations when warm\n",
+                   f, n, (stats_get(STAT_SLAB_ALLOCS) - alloc_slab_before) / ops,
+                   stats_get(STAT_SYSTEM_ALLOCS) - alloc_system_before);
+            destroy_fs();
+            pthread_barrier_destroy(&alloc_barrier);
+        }
+    }
+}
+
+/*
+ * Calls visit on every entry of the directories /d0 to /d(NAMES_DIRS - 1).
+ */
+static unsigned long names_visit(void (*visit)(Directory *dir, DirEntry *entry)) {
+    char path[MAX_FILE_NAME];
+    unsigned long entries = 0;
+    type nType;
+    union Data data;
+
+    for (int d = 0; d < NAMES_DIRS; d++) {
+        sprintf(path, "/d%d", d);
+        if (inode_get(lookup(path), &nType, &data) != SUCCESS)
+            continue;
+
+        DirIterator it;
+        DirEntry *entry;
+
+        directory_iter_init(&it, data.dir);
+        while ((entry = directory_iter_next(&it))) {
+            visit(data.dir, entry);
+            entries++;
+        }
+    }
+    return entries;
+}
+
+static size_t names_bytes, names_fixed_bytes;
+static unsigned long names_checksum;
+
+static void names_account(Directory *dir, DirEntry *entry) {
+    names_bytes += slab_size(offsetof(DirEntry, name) + entry->len + 1);
+    names_fixed_bytes += slab_size(offsetof(DirEntry, name) + MAX_FILE_NAME);
+}
+
+static void names_scan(Directory *dir, DirEntry *entry) {
+    names_checksum += entry->inumber + entry->name[entry->len - 1];
+}
+
+static void names_lookup(Directory *dir, DirEntry *entry) {
+    names_checksum += directory_lookup(dir, entry->name);
+}
+
+/*
+ * Builds a tree of NAMES_DIRS directories of NAMES_FILES files with short
+ * names, then reports the memory of its directory entries (and what names
+ * of MAX_FILE_NAME bytes would take) and the time to scan them and to
+ * look each of them up.
+ */
+void bench_names(int maxThreads) {
+    char path[MAX_FILE_NAME];
+
+    init_fs();
+    for (int d = 0; d < NAMES_DIRS; d++) {
+        sprintf(path, "/d%d", d);
+        create(path, T_DIRECTORY);
+        for (int f = 0; f < NAMES_FILES; f++) {
+            sprintf(path, "/d%d/file%d", d, f);
+            create(path, T_FILE);
+        }
+    }
+
+    unsigned long entries = names_visit(names_account);
+
+    printf("%lu entries: %.1f bytes/entry, %.1f bytes/entry with fixed-size names (%.1f MB vs %.1f MB)\n",
+           entries, (double)names_bytes / entries, (double)names_fixed_bytes / entries,
+           names_bytes / 1048576.0, names_fixed_bytes / 1048576.0);
+
+    unsigned long start = now_us();
+    for (int i = 0; i < NAMES_SCANS; i++)
+        names_visit(names_scan);
+    unsigned long scan_us = now_us() - start;
+
+    start = now_us();
+    for (int i = 0; i < NAMES_SCANS; i++)
+        names_visit(names_lookup);
+    unsigned long lookup_us = now_us() - start;
+
+    printf("scan: %6.1f ns/entry, scan+lookup: %6.1f ns/entry (checksum %lu)\n",
+           1000.0 * scan_us / (NAMES_SCANS * entries), 1000.0 * lookup_us / (NAMES_SCANS * entries),
+           names_checksum);
+    destroy_fs();
+}
+
+/*
+ * Looks names up in directories of growing size with each inline scan
+ * kernel the CPU supports, half of them hits and half misses. Sizes up to
+ * DIR_INLINE_ENTRIES stay inline, bigger ones use the stripe tables.
+ */
+void bench_dirscan(int maxThreads) {
+    int sizes[] = DIRSCAN_SIZES;
+    char names[2 * 256][MAX_FILE_NAME];
+    DirProbe probe;
+
+    init_fs();
+    for (int s = 0; s < sizeof(sizes) / sizeof(int); s++) {
+        Directory *dir = directory_create();
+
+        for (int i = 0; i < 2 * sizes[s]; i++) {
+            sprintf(names[i], "file%d", i);
+            /* the even names are the hits */
+            if (i % 2 == 0)
+                directory_insert(dir, names[i], i);
+        }
+
+        printf("entries=%-4d", sizes[s]);
+        for (DirScan scan = 0; scan < NDIRSCANS; scan++) {
+            if (directory_set_scan(scan) != SUCCESS)
+                continue;
+
+            unsigned long start = now_us();
+            for (int op = 0; op < DIRSCAN_OPS; op++)
+                directory_peek(dir, names[op % (2 * sizes[s])], &probe);
+            printf("  %s %6.1f ns/lookup", directory_scan_name(scan), 1000.0 * (now_us() - start) / DIRSCAN_OPS);
+        }
+        printf("\n");
+        directory_destroy(dir);
+    }
+    directory_set_scan(directory_best_scan());
+    destroy_fs();
+}
+
+/*
+ * Times init_fs with large i-node capacities, the first creates after it,
+ * which initialize their i-nodes, and destroy_fs.
+ */
+void bench_startup(int maxThreads) {
+    int capacities[] = STARTUP_CAPACITIES;
+    char path[MAX_FILE_NAME];
+
+    for (int c = 0; c < sizeof(capacities) / sizeof(int); c++) {
+        inode_set_capacity(capacities[c]);
+
+        unsigned long start = now_us();
+        init_fs();
+        unsigned long init_us = now_us() - start;
+
+        start = now_us();
+        for (int i = 0; i < STARTUP_FILES; i++) {
+            sprintf(path, "/d%d", i % 64);
+            if (i < 64)
+                create(path, T_DIRECTORY);
+            sprintf(path, "/d%d/f%d", i % 64, i);
+            create(path, T_FILE);
+        }
+        unsigned long create_us = now_us() - start;
+
+        if (c == 0)
+            hugepage_print_stats(stdout);
+
+        start = now_us();
+        destroy_fs();
+        printf("capacity=%-9d init_fs %8.3f ms, first %d creates %6.1f ms, destroy_fs %8.3f ms\n",
+               capacities[c], init_us / 1000.0, STARTUP_FILES, create_us / 1000.0, (now_us() - start) / 1000.0);
+    }
+    inode_set_capacity(INODE_MAX_SEGMENTS * INODE_SEGMENT_SIZE);
+}
+
+/*
+ * Throughput of one way of accessing a file for the files benchmark.
+ */
+static void files_report(char *what, long bytes, unsigned long us) {
+    printf("  %s %8.1f MB/s", what, us ? (double)bytes / us : 0.0);
+}
+
+/*
+ * Appends, random writes and random reads of FILES_RANDOM_IO bytes on files
+ * of each size, through the calls that serve open descriptors. Appends are
+ * done in MAX_IO_SIZE writes, like the requests of tfsWrite, truncating
+ * the file and starting over until FILES_BYTES are written.
+ */
+void bench_files(int maxThreads) {
+    long sizes[] = FILES_SIZES;
+    char *buffer = malloc(MAX_IO_SIZE);
+    unsigned long seed = 88172645463325252UL;
+
+    if (!buffer) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(buffer, 'x', MAX_IO_SIZE);
+
+    init_fs();
+    create("/f", T_FILE);
+    int inumber = file_open("/f");
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(long); s++) {
+        long size = sizes[s], done = 0;
+        long chunk = size < MAX_IO_SIZE ? size : MAX_IO_SIZE;
+        long ops = FILES_BYTES / FILES_RANDOM_IO;
+
+        printf("size=%-10ld", size);
+
+        unsigned long start = now_us();
+        while (done < FILES_BYTES) {
+            file_truncate(inumber, 0);
+            for (long offset = 0; offset < size; offset += chunk)
+                file_write(inumber, buffer, chunk, offset);
+            done += size;
+        }
+        files_report("append", done, now_us() - start);
+
+        start = now_us();
+        for (long op = 0; op < ops; op++) {
+            seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+            file_write(inumber, buffer, FILES_RANDOM_IO, seed % (size / FILES_RANDOM_IO) * FILES_RANDOM_IO);
+        }
+        files_report("random write", ops * FILES_RANDOM_IO, now_us() - start);
+
+        start = now_us();
+        for (long op = 0; op < ops; op++) {
+            seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+            file_read(inumber, buffer, FILES_RANDOM_IO, seed % (size / FILES_RANDOM_IO) * FILES_RANDOM_IO);
+        }
+        files_report("random read", ops * FILES_RANDOM_IO, now_us() - start);
+
+        start = now_us();
+        file_truncate(inumber, 0);
+        printf("  truncate %8.3f ms\n", (now_us() - start) / 1000.0);
+    }
+
+    extent_print_stats(stdout);
+    file_close(inumber);
+    destroy_fs();
+    free(buffer);
+}
+
+/*
+ * Writes the thread's own RANGES_REGION bytes of the file, RANGES_ROUNDS
+ * times, in MAX_IO_SIZE writes.
+ */
+void *ranges_worker(void *arg) {
+    BenchThread *self = arg;
+    int inumber = *(int*)self->arg;
+    char buffer[MAX_IO_SIZE];
+
+    memset(buffer, 'a' + self->id, MAX_IO_SIZE);
+    for (int round = 0; round < RANGES_ROUNDS; round++)
+        for (long offset = 0; offset < RANGES_REGION; offset += MAX_IO_SIZE)
+            file_write(inumber, buffer, MAX_IO_SIZE, self->id * RANGES_REGION + offset);
+    return NULL;
+}
+
+/*
+ * N threads writing disjoint regions of one file, with writes that share
+ * the file through byte-range locks and with writes that lock all of it.
+ */
+void bench_ranges(int maxThreads) {
+    for (int enabled = FALSE; enabled <= TRUE; enabled++)
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            set_range_locking(enabled);
+            init_fs();
+            create("/f", T_FILE);
+            int inumber = file_open("/f");
+            unsigned long waits = stats_get(STAT_RANGELOCK_WAITS);
+
+            double secs = run_threads(n, ranges_worker, &inumber);
+            printf("range locks=%-3s threads=%-3d %8.1f MB/s, %lu waits for a range\n", enabled ? "on" : "off", n,
+                   n * RANGES_ROUNDS * RANGES_REGION / secs / 1e6, stats_get(STAT_RANGELOCK_WAITS) - waits);
+            file_close(inumber);
+            destroy_fs();
+        }
+    set_range_locking(TRUE);
+}
+
+/*
+ * Appends APPEND_BYTES to the file in MAX_IO_SIZE records.
+ */
+void *append_worker(void *arg) {
+    BenchThread *self = arg;
+    int inumber = *(int*)self->arg;
+    char buffer[MAX_IO_SIZE];
+    long offset;
+
+    memset(buffer, 'a' + self->id, MAX_IO_SIZE);
+    for (long done = 0; done < APPEND_BYTES; done += MAX_IO_SIZE)
+        file_append(inumber, buffer, MAX_IO_SIZE, &offset);
+    return NULL;
+}
+
+/*
+ * N threads appending to one file, with appends that share the file through
+ * its append log and with appends that lock all of it.
+ */
+void bench_append(int maxThreads) {
+    for (int enabled = FALSE; enabled <= TRUE; enabled++)
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            set_shared_appends(enabled);
+            init_fs();
+            create("/f", T_FILE);
+            int inumber = file_open("/f");
+            unsigned long waits = stats_get(STAT_APPLOG_COMMIT_WAITS), folds = stats_get(STAT_APPLOG_FOLDS);
+
+            double secs = run_threads(n, append_worker, &inumber);
+            printf("shared appends=%-3s threads=%-3d %8.1f MB/s, %lu waits to commit, %lu folds\n",
+                   enabled ? "on" : "off", n, n * APPEND_BYTES / secs / 1e6,
+                   stats_get(STAT_APPLOG_COMMIT_WAITS) - waits, stats_get(STAT_APPLOG_FOLDS) - folds);
+            file_close(inumber);
+            destroy_fs();
+        }
+    set_shared_appends(TRUE);
+}
+
+/*
+ * Sums the words of a buffer, so that every byte a client got is read.
+ */
+static unsigned long map_checksum(char *data, long size) {
+    unsigned long sum = 0;
+
+    for (long i = 0; i + sizeof(unsigned long) <= size; i += sizeof(unsigned long))
+        sum += *(unsigned long*)(data + i);
+    return sum;
+}
+
+/*
+ * Starts a server process with one thread on a socket, its output discarded.
+ * Returns: the pid of the server, once the socket exists
+ */
+static pid_t map_start_server(char *socket) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        fprintf(stderr, "Error: fork failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+
+        dup2(null, STDOUT_FILENO);
+        execl(SERVER_PATH, SERVER_PATH, "1", socket, (char*)NULL);
+        fprintf(stderr, "Error: can't run %s, build it with make first\n", SERVER_PATH);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long start = now_us();
+    while (access(socket, F_OK) != 0) {
+        if (now_us() - start > SERVER_START_US || waitpid(pid, NULL, WNOHANG) == pid) {
+            fprintf(stderr, "Error: server didn't start\n");
+            exit(EXIT_FAILURE);
+        }
+        usleep(1000);
+    }
+    return pid;
+}
+
+/*
+ * Reads whole files of 1MB to 1GB from a server process through the client
+ * API, copied through the socket in MAX_IO_SIZE replies (tfsRead) and
+ * passed as a sealed memfd that the client maps (tfsMap). The client reads
+ * every byte either way. The second map finds the snapshot the first one
+ * made.
+ */
+void bench_map(int maxThreads) {
+    long sizes[] = MAP_SIZES;
+    long max_size = sizes[sizeof(sizes) / sizeof(long) - 1];
+    char socket[MAX_FILE_NAME], chunk[MAX_IO_SIZE];
+    char *buffer = malloc(max_size);
+
+    if (!buffer) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < MAX_IO_SIZE; i++)
+        chunk[i] = i * 31 + 7;
+
+    snprintf(socket, sizeof(socket), "/tmp/tecnicofs-bench-%d", getpid());
+    pid_t server = map_start_server(socket);
+
+    if (tfsMount(socket) != SUCCESS) {
+        fprintf(stderr, "Error: can't mount %s\n", socket);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(long); s++) {
+        long size = sizes[s];
+        char *data;
+
+        /* a new file each time, read from the start by a new descriptor */
+        tfsCreate("/f", 'f');
+        int fd = tfsOpen("/f", WRITE);
+        for (long offset = 0; offset < size; offset += MAX_IO_SIZE)
+            tfsWrite(fd, chunk, MAX_IO_SIZE);
+        tfsClose(fd);
+        fd = tfsOpen("/f", READ);
+
+        unsigned long start = now_us();
+        int copied = tfsRead(fd, buffer, size);
+        unsigned long copy_sum = map_checksum(buffer, copied);
+        unsigned long copy_us = now_us() - start;
+
+        unsigned long map_us[2], map_sum[2];
+        int mapped[2];
+        for (int m = 0; m < 2; m++) {
+            start = now_us();
+            mapped[m] = tfsMap(fd, &data);
+            map_sum[m] = map_checksum(data, mapped[m]);
+            map_us[m] = now_us() - start;
+            tfsUnmap(data, mapped[m]);
+        }
+
+        if (copied != size || mapped[0] != size || mapped[1] != size || map_sum[0] != copy_sum || map_sum[1] != copy_sum) {
+            fprintf(stderr, "Error: size %ld read %d, mapped %d and %d, checksums differ\n",
+                    size, copied, mapped[0], mapped[1]);
+            exit(EXIT_FAILURE);
+        }
+        printf("size=%-10ld socket copy %8.1f MB/s  fd passing %8.1f MB/s  again %8.1f MB/s\n", size,
+               (double)size / copy_us, (double)size / map_us[0], (double)size / map_us[1]);
+
+        tfsClose(fd);
+        tfsDelete("/f");
+    }
+
+    tfsUnmount();
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(socket);
+    free(buffer);
+}
+
+Benchmark benchmarks[] = {
+    {"create", "i-node allocation throughput", bench_create},
+    {"coupling", "lock hold times on ancestors, with and without lock coupling", bench_coupling},
+    {"brlock", "lookup-heavy root workload, rwlock vs brlock (try maxthreads 64)", bench_brlock},
+    {"samedir", "creates and deletes of different names in one directory", bench_samedir},
+    {"cross", "moves between two directories in opposite directions", bench_cross},
+    {"rename", "moves between sibling directories deep in the tree", bench_rename},
+    {"disjoint", "moves in separate subtrees and in one shared subtree", bench_disjoint},
+    {"locks", "proj2 input workloads with each i-node lock implementation", bench_locks},
+    {"sync", "proj2 input workloads with each synchronization strategy", bench_sync},
+    {"alloc", "allocations of the proj2 input workloads once the caches are warm", bench_alloc},
+    {"layout", "cache misses of the lookup heavy proj2 inputs (needs perf counters, see bench_packed)", bench_layout},
+    {"names", "memory and scan time of directory entries in a million-entry tree", bench_names},
+    {"dirscan", "lookups in directories of each size with each inline scan kernel", bench_dirscan},
+    {"startup", "server startup and shutdown with large i-node capacities", bench_startup},
+    {"files", "appends, random writes and random reads on files of 4KB to 1GB", bench_files},
+    {"ranges", "threads writing disjoint 1MB regions of one file, with and without range locks", bench_ranges},
+    {"append", "threads appending to one file, with and without the append log", bench_append},
+    {"map", "client reads of 1MB to 1GB files, socket copy vs memfd passing (needs ./server)", bench_map},
+};
+
+int main(int argc, char *argv[]) {
+    int maxThreads = DEFAULT_MAX_THREADS;
+    int count = sizeof(benchmarks) / sizeof(Benchmark);
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s benchmark [maxthreads]\nBenchmarks:\n", argv[0]);
+        for (int i = 0; i < count; i++)
+            fprintf(stderr, "  %-12s %s\n", benchmarks[i].name, benchmarks[i].description);
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc == 3 && (maxThreads = atoi(argv[2])) <= 0) {
+        fprintf(stderr, "Error: invalid number of threads.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++)
+        if (strcmp(argv[1], benchmarks[i].name) == 0 || strcmp(argv[1], "all") == 0) {
+            printf("== %s: %s\n", benchmarks[i].name, benchmarks[i].description);
+            benchmarks[i].run(maxThreads);
+            if (strcmp(argv[1], "all") != 0)
+                exit(EXIT_SUCCESS);
+        }
+
+    if (strcmp(argv[1], "all") != 0) {
+        fprintf(stderr, "Error: unknown benchmark %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "applog.h"
+#include "slab.h"
+#include "stats.h"
+
+/*
+ * Creates an empty log for a file.
+ * Input:
+ *  - size: size of the file, where the first append goes
+ * Returns: the log
+ */
+AppendLog *applog_create(long size) {
+    AppendLog *log = slab_alloc(sizeof(AppendLog));
+
+    log->blocks.root = NULL;
+    log->blocks.levels = APPLOG_LEVELS;
+    log->base = log->reserved = size;
+    log->queued = 0;
+    return log;
+}
+
+/*
+ * Frees a log and the blocks that weren't folded.
+ */
+void applog_destroy(AppendLog *log) {
+    extent_truncate(&log->blocks, 0);
+    slab_free(log);
+}
+
+/*
+ * Takes the offset of an append.
+ * Input:
+ *  - log: the log
+ *  - len: number of bytes to append
+ * Returns: where the append starts, the next one starts len bytes later
+ */
+long applog_reserve(AppendLog *log, long len) {
+    return __atomic_fetch_add(&log->reserved, len, __ATOMIC_RELAXED);
+}
+
+/*
+ * Copies the data of an append into the log, see applog_reserve.
+ */
+void applog_write(AppendLog *log, char *buffer, long len, long offset) {
+    extent_write(&log->blocks, buffer, len, offset);
+    stats_add(STAT_APPLOG_BYTES, len);
+}
+
+/*
+ * Publishes an append by growing the size of the file past it, once the
+ * appends that took the offsets before it are published. Readers never
+ * see a byte past the size, so they never see an append that is still
+ * being copied.
+ * Input:
+ *  - size: size of the file
+ *  - offset: where the append starts
+ *  - end: where it ends
+ */
+void applog_commit(int *size, long offset, long end) {
+    if (__atomic_load_n(size, __ATOMIC_ACQUIRE) != offset) {
+        stats_add(STAT_APPLOG_COMMIT_WAITS, 1);
+        /* an earlier appender may not be running, on a single CPU above all */
+        while (__atomic_load_n(size, __ATOMIC_ACQUIRE) != offset)
+            sched_yield();
+    }
+    __atomic_store_n(size, (int)end, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies part of the log, the bytes must be from base on.
+ */
+void applog_read(AppendLog *log, char *buffer, long len, long offset) {
+    extent_read(&log->blocks, buffer, len, offset);
+}
+
+/*
+ * Moves the log up to end into the contents of the file, see extent_move.
+ * No append may be running.
+ * Input:
+ *  - log: the log
+ *  - contents: extents of the file, with nothing from base on
+ *  - end: where the log will start, at most the size of the file
+ */
+void applog_fold(AppendLog *log, ExtentMap *contents, long end) {
+    if (end <= log->base)
+        return;
+
+    extent_move(contents, &log->blocks, log->base, end);
+    stats_add(STAT_APPLOG_FOLDS, 1);
+    stats_add(STAT_APPLOG_FOLDED_BYTES, end - log->base);
+    log->base = end;
+}
+
+/*
+ * Starts an empty log over at the end of a file whose size changed other
+ * than by appending. No append may be running.
+ * Input:
+ *  - log: the log, fully folded
+ *  - size: size of the file
+ */
+void applog_rebase(AppendLog *log, long size) {
+    log->base = log->reserved = size;
+}
@@ -0,0 +1,43 @@
+#ifndef APPLOG_H
+#define APPLOG_H
+
+#include "extent.h"
+
+/* levels of the index of a log, enough for any offset of a file (INT_MAX),
+ * so that appenders never have to add one */
+#define APPLOG_LEVELS 3
+
+/* appends that cross a multiple of this many bytes have the compactor fold
+ * the log into the file (see compactor.h) */
+#define APPLOG_FOLD_SIZE (1L << 20)
+
+/*
+ * Log of a file opened for appending. Appends take their offset with a
+ * single fetch-and-add on the end of the log and copy their data into the
+ * log's blocks, only read locking the i-node: they never read or rewrite
+ * the contents already in the file, and appenders don't wait for each
+ * other except to publish the new size in the order of their offsets.
+ * The bytes from base on live in the log, indexed like the extents of a
+ * file but with all its levels from the start, so that appenders only ever
+ * fill empty slots (see extent_write). The compactor hands the full
+ * blocks over to the file's extents, which moves pointers rather than
+ * data, with the i-node write locked.
+ */
+typedef struct appendLog {
+	ExtentMap blocks; /* the appended bytes, at their offsets in the file */
+	long base; /* start of the log, the bytes before it are in the file */
+	long reserved; /* end of the appends that took their offset */
+	int queued; /* TRUE while the file waits for the compactor */
+} AppendLog;
+
+
+AppendLog *applog_create(long size);
+void applog_destroy(AppendLog *log);
+long applog_reserve(AppendLog *log, long len);
+void applog_write(AppendLog *log, char *buffer, long len, long offset);
+void applog_commit(int *size, long offset, long end);
+void applog_read(AppendLog *log, char *buffer, long len, long offset);
+void applog_fold(AppendLog *log, ExtentMap *contents, long end);
+void applog_rebase(AppendLog *log, long size);
+
+#endif /* APPLOG_H */
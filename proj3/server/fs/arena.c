@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "state.h"
+#include "stats.h"
+#include "arena.h"
+
+/* the calling thread's blocks, and the one allocations come from */
+static __thread ArenaBlock *arena_head = NULL, *arena_current = NULL;
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+static unsigned long arena_blocks = 0, arena_bytes = 0;
+
+/*
+ * Frees the blocks of an exiting thread.
+ */
+static void arena_free_blocks(void *arg) {
+    ArenaBlock *block = arg, *next;
+
+    for (; block; block = next) {
+        next = block->next;
+        __atomic_sub_fetch(&arena_blocks, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&arena_bytes, block->size, __ATOMIC_RELAXED);
+        free(block);
+    }
+}
+
+static void arena_key_init() {
+    if (pthread_key_create(&arena_key, arena_free_blocks) != 0) {
+        fprintf(stderr, "Error: failed to create thread key\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Allocates a block and links it after the current one.
+ * Input:
+ *  - size: minimum free space of the block
+ */
+static ArenaBlock *arena_grow(size_t size) {
+    if (size < ARENA_BLOCK_SIZE)
+        size = ARENA_BLOCK_SIZE;
+
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+
+    if (!block) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    block->size = size;
+    block->used = 0;
+    stats_add(STAT_SYSTEM_ALLOCS, 1);
+    __atomic_add_fetch(&arena_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&arena_bytes, size, __ATOMIC_RELAXED);
+
+    if (!arena_head) {
+        pthread_once(&arena_once, arena_key_init);
+        block->next = NULL;
+        arena_head = block;
+        pthread_setspecific(arena_key, arena_head);
+    }
+    else {
+        block->next = arena_current->next;
+        arena_current->next = block;
+    }
+    return block;
+}
+
+/*
+ * Allocates memory from the calling thread's arena.
+ * Input:
+ *  - size: size of the allocation
+ * Returns: pointer to the memory, aligned to 16 bytes
+ */
+void *arena_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+
+    if (!arena_current)
+        arena_current = arena_head ? arena_head : arena_grow(size);
+
+    /* blocks after the current one are free, reuse the first big enough */
+    while (arena_current->used + size > arena_current->size) {
+        ArenaBlock *next = arena_current->next;
+
+        while (next && next->size < size)
+            next = next->next;
+        arena_current = next ? next : arena_grow(size);
+        arena_current->used = 0;
+    }
+
+    void *ptr = arena_current->data + arena_current->used;
+
+    arena_current->used += size;
+    return ptr;
+}
+
+/*
+ * Returns the current position of the calling thread's arena.
+ */
+ArenaMark arena_mark() {
+    ArenaMark mark = {arena_current, arena_current ? arena_current->used : 0};
+    return mark;
+}
+
+/*
+ * Releases everything allocated after a mark, which must be the most
+ * recent one still held.
+ */
+void arena_release(ArenaMark mark) {
+    if (!mark.block) {
+        arena_reset();
+        return;
+    }
+    arena_current = mark.block;
+    arena_current->used = mark.used;
+}
+
+/*
+ * Releases everything allocated by the calling thread. Called after each
+ * request.
+ */
+void arena_reset() {
+    arena_current = arena_head;
+    if (arena_current)
+        arena_current->used = 0;
+}
+
+/*
+ * Prints the arena statistics.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void arena_print_stats(FILE *fp) {
+    fprintf(fp, "arena: %lu blocks, %lu KB of request scratch memory\n",
+            __atomic_load_n(&arena_blocks, __ATOMIC_RELAXED),
+            __atomic_load_n(&arena_bytes, __ATOMIC_RELAXED) / 1024);
+}
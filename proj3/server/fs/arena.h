@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* size of the blocks the arena grows by, bigger requests get a block of their own */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/*
+ * Per-thread bump allocator for memory that only lives during one request,
+ * like the entries of a lock set that outgrew its inline ones. Blocks are
+ * kept when the arena is reset, so a warm thread never calls malloc for it.
+ * Allocations are released in LIFO order with arena_mark/arena_release, or
+ * all at once with arena_reset after each request.
+ */
+typedef struct arenaBlock {
+	struct arenaBlock *next;
+	size_t size;
+	size_t used;
+	char data[];
+} ArenaBlock;
+
+/*
+ * Position of the arena, to release what was allocated after it
+ */
+typedef struct arenaMark {
+	ArenaBlock *block;
+	size_t used;
+} ArenaMark;
+
+
+void *arena_alloc(size_t size);
+ArenaMark arena_mark();
+void arena_release(ArenaMark mark);
+void arena_reset();
+void arena_print_stats(FILE *fp);
+
+#endif /* ARENA_H */
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include "state.h"
+#include "brlock.h"
+
+/*
+ * Slot used by the calling thread in every lock. It is fixed per thread
+ * rather than per CPU, as a thread may migrate between lock and unlock.
+ */
+static int next_slot = 0;
+static __thread int thread_slot = -1;
+
+static BrSlot *brlock_slot(BrLock *lock) {
+    if (thread_slot == -1)
+        thread_slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) % BRLOCK_SLOTS;
+    return &lock->slots[thread_slot];
+}
+
+static void writer_lock(BrLock *lock) {
+    if (pthread_mutex_lock(&lock->writer_lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void writer_unlock(BrLock *lock) {
+    if (pthread_mutex_unlock(&lock->writer_lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Allocates an unlocked big-reader lock.
+ * Returns: pointer to the lock
+ */
+BrLock *brlock_create() {
+    BrLock *lock;
+
+    if (posix_memalign((void**)&lock, sizeof(BrSlot), sizeof(BrLock)) != 0) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < BRLOCK_SLOTS; i++)
+        lock->slots[i].readers = 0;
+    lock->writer = FALSE;
+    if (pthread_mutex_init(&lock->writer_lock, NULL) != 0) {
+        fprintf(stderr, "Error: failed to initialize mutex\n");
+        exit(EXIT_FAILURE);
+    }
+    return lock;
+}
+
+void brlock_destroy(BrLock *lock) {
+    if (pthread_mutex_destroy(&lock->writer_lock) != 0) {
+        fprintf(stderr, "Error: failed to destroy mutex\n");
+        exit(EXIT_FAILURE);
+    }
+    free(lock);
+}
+
+/*
+ * Tries to enter as a reader.
+ * Returns: SUCCESS, or FAIL if a writer holds or is waiting for the lock
+ */
+int brlock_tryrdlock(BrLock *lock) {
+    BrSlot *slot = brlock_slot(lock);
+
+    __atomic_fetch_add(&slot->readers, 1, __ATOMIC_RELAXED);
+    /* the writer checks the slots after setting the flag, we check the flag after the slot */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&lock->writer, __ATOMIC_ACQUIRE))
+        return SUCCESS;
+
+    __atomic_fetch_sub(&slot->readers, 1, __ATOMIC_RELEASE);
+    return FAIL;
+}
+
+void brlock_rdlock(BrLock *lock) {
+    while (brlock_tryrdlock(lock) != SUCCESS) {
+        /* sleep until the writer is done */
+        writer_lock(lock);
+        writer_unlock(lock);
+    }
+}
+
+void brlock_rdunlock(BrLock *lock) {
+    __atomic_fetch_sub(&brlock_slot(lock)->readers, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns: TRUE if no reader is in any slot
+ */
+static int brlock_no_readers(BrLock *lock) {
+    for (int i = 0; i < BRLOCK_SLOTS; i++)
+        if (__atomic_load_n(&lock->slots[i].readers, __ATOMIC_ACQUIRE) != 0)
+            return FALSE;
+    return TRUE;
+}
+
+void brlock_wrlock(BrLock *lock) {
+    writer_lock(lock);
+    __atomic_store_n(&lock->writer, TRUE, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!brlock_no_readers(lock))
+        sched_yield();
+}
+
+/*
+ * Tries to enter as the writer.
+ * Returns: SUCCESS, or FAIL if the lock is held
+ */
+int brlock_trywrlock(BrLock *lock) {
+    if (pthread_mutex_trylock(&lock->writer_lock) != 0)
+        return FAIL;
+    __atomic_store_n(&lock->writer, TRUE, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (brlock_no_readers(lock))
+        return SUCCESS;
+
+    __atomic_store_n(&lock->writer, FALSE, __ATOMIC_RELEASE);
+    writer_unlock(lock);
+    return FAIL;
+}
+
+void brlock_wrunlock(BrLock *lock) {
+    __atomic_store_n(&lock->writer, FALSE, __ATOMIC_RELEASE);
+    writer_unlock(lock);
+}
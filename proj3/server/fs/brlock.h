@@ -0,0 +1,33 @@
+#ifndef BRLOCK_H
+#define BRLOCK_H
+
+/* reader slots of each lock, one cache line each */
+#define BRLOCK_SLOTS 64
+
+/*
+ * Big-reader lock. Each reader only touches its own slot, so readers on
+ * different CPUs don't share cache lines; a writer has to visit every slot
+ * and wait until all of them are empty. Writers are preferred: once one
+ * sets the writer flag new readers back off until it is done.
+ */
+typedef struct brSlot {
+	int readers;
+} __attribute__((aligned(64))) BrSlot;
+
+typedef struct brLock {
+	BrSlot slots[BRLOCK_SLOTS];
+	pthread_mutex_t writer_lock;
+	int writer;
+} BrLock;
+
+
+BrLock *brlock_create();
+void brlock_destroy(BrLock *lock);
+void brlock_rdlock(BrLock *lock);
+int brlock_tryrdlock(BrLock *lock);
+void brlock_rdunlock(BrLock *lock);
+void brlock_wrlock(BrLock *lock);
+int brlock_trywrlock(BrLock *lock);
+void brlock_wrunlock(BrLock *lock);
+
+#endif /* BRLOCK_H */
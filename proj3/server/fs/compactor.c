@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "compactor.h"
+#include "slab.h"
+
+#define FALSE 0
+#define TRUE 1
+
+static pthread_t compactor;
+static pthread_mutex_t compactor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compactor_wakeup = PTHREAD_COND_INITIALIZER;
+static CompactItem *head = NULL, **tail = &head;
+static int running = FALSE;
+static void (*compact_file)(int inumber);
+
+static void compactor_mutex_lock() {
+    if (pthread_mutex_lock(&compactor_lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void compactor_mutex_unlock() {
+    if (pthread_mutex_unlock(&compactor_lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Background compactor: folds the queued files one at a time, without
+ * holding the queue lock.
+ */
+static void *compactor_thread(void *arg) {
+    compactor_mutex_lock();
+    while (running) {
+        if (!head) {
+            if (pthread_cond_wait(&compactor_wakeup, &compactor_lock) != 0) {
+                fprintf(stderr, "Error: failed to wait on condition\n");
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+
+        CompactItem *item = head;
+
+        if (!(head = item->next))
+            tail = &head;
+        compactor_mutex_unlock();
+
+        compact_file(item->inumber);
+        slab_free(item);
+
+        compactor_mutex_lock();
+    }
+    compactor_mutex_unlock();
+    return NULL;
+}
+
+/*
+ * Starts the compactor thread.
+ * Input:
+ *  - compact: folds the log of a file, with its i-node locked as needed
+ */
+void compactor_init(void (*compact)(int inumber)) {
+    compact_file = compact;
+    head = NULL;
+    tail = &head;
+    running = TRUE;
+    if (pthread_create(&compactor, NULL, compactor_thread, NULL) != 0) {
+        fprintf(stderr, "Error: failed to create compactor thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Stops the compactor thread. Files still queued are left as they are,
+ * their logs are folded when they are closed or freed with the i-node.
+ */
+void compactor_destroy() {
+    compactor_mutex_lock();
+    running = FALSE;
+    pthread_cond_signal(&compactor_wakeup);
+    compactor_mutex_unlock();
+
+    if (pthread_join(compactor, NULL) != 0) {
+        fprintf(stderr, "Error: failed to join compactor thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (head) {
+        CompactItem *item = head;
+
+        head = item->next;
+        slab_free(item);
+    }
+    tail = &head;
+}
+
+/*
+ * Queues a file for the compactor.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ */
+void compactor_queue(int inumber) {
+    CompactItem *item = slab_alloc(sizeof(CompactItem));
+
+    item->inumber = inumber;
+    item->next = NULL;
+
+    compactor_mutex_lock();
+    *tail = item;
+    tail = &item->next;
+    pthread_cond_signal(&compactor_wakeup);
+    compactor_mutex_unlock();
+}
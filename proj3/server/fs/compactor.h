@@ -0,0 +1,20 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+/*
+ * Background thread that folds the logs of files opened for appending into
+ * their extents (see applog.h), so that appenders never do it themselves.
+ * Files are queued by inumber; one may be deleted, or its inumber reused,
+ * before its turn, so the fold checks the i-node again once it is locked.
+ */
+typedef struct compactItem {
+	struct compactItem *next;
+	int inumber;
+} CompactItem;
+
+
+void compactor_init(void (*compact)(int inumber));
+void compactor_destroy();
+void compactor_queue(int inumber);
+
+#endif /* COMPACTOR_H */
@@ -0,0 +1,322 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "state.h"
+#include "dcache.h"
+#include "slab.h"
+#include "arena.h"
+
+static DcacheShard shards[DCACHE_SHARDS];
+static unsigned long subtree_gens[DCACHE_SUBTREE_GENS];
+
+/*
+ * Copies a path removing the leading, trailing and repeated slashes, so
+ * that every spelling of a path maps to the same cache entry. The copy is
+ * taken from the arena of the calling thread, callers release it with
+ * arena_release.
+ * Input:
+ *  - path: path to normalize
+ * Returns: the normalized path
+ */
+static char *dcache_key(char *path) {
+    char *key = arena_alloc(strlen(path) + 1);
+    int len = 0;
+
+    for (char *c = path; *c; c++) {
+        if (*c == '/' && (len == 0 || key[len - 1] == '/'))
+            continue;
+        key[len++] = *c;
+    }
+    if (len > 0 && key[len - 1] == '/')
+        len--;
+    key[len] = '\0';
+    return key;
+}
+
+/*
+ * Adds up the subtree generations of a path and of all its ancestors, the
+ * root ("") included. Generations only grow, so the sum changes whenever
+ * any of them is invalidated. The hash of each prefix is the one dir_hash
+ * gives, computed on the way.
+ * Input:
+ *  - key: normalized path
+ * Returns: the stamp of the path
+ */
+static unsigned long dcache_stamp(char *key) {
+    unsigned int hash = 2166136261u;
+    unsigned long stamp = 0;
+
+    for (unsigned char *c = (unsigned char*)key; *c; c++) {
+        if (*c == '/')
+            stamp += __atomic_load_n(&subtree_gens[hash % DCACHE_SUBTREE_GENS], __ATOMIC_ACQUIRE);
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return stamp + __atomic_load_n(&subtree_gens[hash % DCACHE_SUBTREE_GENS], __ATOMIC_ACQUIRE);
+}
+
+static DcacheShard *dcache_shard(unsigned int hash) {
+    return &shards[(hash >> 16) % DCACHE_SHARDS];
+}
+
+static void shard_lock(DcacheShard *shard, int write) {
+    if ((write ? pthread_rwlock_wrlock(&shard->lock) : pthread_rwlock_rdlock(&shard->lock)) != 0) {
+        fprintf(stderr, "Error: failed to lock dcache shard\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void shard_unlock(DcacheShard *shard) {
+    if (pthread_rwlock_unlock(&shard->lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock dcache shard\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Removes an entry from its bucket. The shard must be write locked.
+ * Input:
+ *  - link: pointer to the link that points to the entry
+ */
+static void shard_remove(DcacheShard *shard, DcacheEntry **link) {
+    DcacheEntry *entry = *link;
+    *link = entry->next;
+    slab_free(entry);
+    shard->count--;
+}
+
+/*
+ * Initializes the dentry cache.
+ */
+void dcache_init() {
+    for (int i = 0; i < DCACHE_SHARDS; i++) {
+        memset(&shards[i], 0, sizeof(DcacheShard));
+        if (pthread_rwlock_init(&shards[i].lock, NULL) != 0) {
+            fprintf(stderr, "Error: failed to initialize lock\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(subtree_gens, 0, sizeof(subtree_gens));
+}
+
+/*
+ * Releases all the entries of the dentry cache.
+ */
+void dcache_destroy() {
+    for (int i = 0; i < DCACHE_SHARDS; i++) {
+        for (int b = 0; b < DCACHE_SHARD_BUCKETS; b++)
+            while (shards[i].buckets[b])
+                shard_remove(&shards[i], &shards[i].buckets[b]);
+        if (pthread_rwlock_destroy(&shards[i].lock) != 0) {
+            fprintf(stderr, "Error: failed to destroy rwlock\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+ * Returns the generation of a path: that of the shard that holds it plus
+ * its stamp. It must be read before resolving the path and passed to
+ * dcache_insert.
+ * Input:
+ *  - path: path that will be inserted
+ */
+unsigned long dcache_gen(char *path) {
+    ArenaMark mark = arena_mark();
+    char *key = dcache_key(path);
+    unsigned long gen = __atomic_load_n(&dcache_shard(dir_hash(key))->gen, __ATOMIC_ACQUIRE) + dcache_stamp(key);
+
+    arena_release(mark);
+    return gen;
+}
+
+/*
+ * Returns the stamp of a path, which changes once the path or one of its
+ * ancestors is moved (see dcache_invalidate_subtree).
+ * Input:
+ *  - path: path of the node
+ */
+unsigned long dcache_moves(char *path) {
+    ArenaMark mark = arena_mark();
+    unsigned long stamp = dcache_stamp(dcache_key(path));
+
+    arena_release(mark);
+    return stamp;
+}
+
+/*
+ * Same as dcache_lookup, for a normalized path other than the root.
+ */
+static int dcache_lookup_key(char *key) {
+    int inumber = FAIL;
+    unsigned int hash = dir_hash(key);
+    DcacheShard *shard = dcache_shard(hash);
+
+    shard_lock(shard, FALSE);
+    for (DcacheEntry *entry = shard->buckets[hash % DCACHE_SHARD_BUCKETS]; entry; entry = entry->next)
+        if (entry->hash == hash && strcmp(entry->path, key) == 0) {
+            /* an entry below a moved directory is left for an insert or
+             * an eviction to replace */
+            if (entry->stamp == dcache_stamp(key))
+                inumber = entry->inumber;
+            else
+                __atomic_fetch_add(&shard->invalidations, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    shard_unlock(shard);
+
+    __atomic_fetch_add(inumber == FAIL ? &shard->misses : &shard->hits, 1, __ATOMIC_RELAXED);
+    return inumber;
+}
+
+/*
+ * Looks for a path in the cache.
+ * Input:
+ *  - path: path of node
+ * Returns:
+ *  inumber: identifier of the i-node, if cached
+ *     FAIL: otherwise
+ */
+int dcache_lookup(char *path) {
+    ArenaMark mark = arena_mark();
+    char *key = dcache_key(path);
+    /* the root is never cached */
+    int inumber = key[0] == '\0' ? FS_ROOT : dcache_lookup_key(key);
+
+    arena_release(mark);
+    return inumber;
+}
+
+/*
+ * Same as dcache_insert, for a normalized path other than the root.
+ */
+static void dcache_insert_key(char *key, int inumber, unsigned long gen) {
+    unsigned int hash = dir_hash(key);
+    DcacheShard *shard = dcache_shard(hash);
+    DcacheEntry **bucket = &shard->buckets[hash % DCACHE_SHARD_BUCKETS];
+
+    shard_lock(shard, TRUE);
+
+    unsigned long stamp = dcache_stamp(key);
+
+    if (shard->gen + stamp != gen) {
+        shard_unlock(shard);
+        return;
+    }
+
+    for (DcacheEntry *entry = *bucket; entry; entry = entry->next)
+        if (entry->hash == hash && strcmp(entry->path, key) == 0) {
+            entry->inumber = inumber;
+            entry->stamp = stamp;
+            shard_unlock(shard);
+            return;
+        }
+
+    /* full shard, evict the oldest entry of the first non-empty bucket */
+    for (unsigned int b = hash; shard->count >= DCACHE_SHARD_MAX; b++) {
+        DcacheEntry **link = &shard->buckets[b % DCACHE_SHARD_BUCKETS];
+        if (!*link)
+            continue;
+        while ((*link)->next)
+            link = &(*link)->next;
+        shard_remove(shard, link);
+        shard->evictions++;
+    }
+
+    DcacheEntry *entry = slab_alloc(sizeof(DcacheEntry) + strlen(key) + 1);
+    entry->hash = hash;
+    entry->inumber = inumber;
+    entry->stamp = stamp;
+    strcpy(entry->path, key);
+    entry->next = *bucket;
+    *bucket = entry;
+    shard->count++;
+    shard->inserts++;
+
+    shard_unlock(shard);
+}
+
+/*
+ * Caches a resolved path. The insert is dropped if an invalidation hit the
+ * shard since gen was read, as the path may have been resolved before the
+ * change it invalidated.
+ * Input:
+ *  - path: path of node
+ *  - inumber: identifier of the i-node
+ *  - gen: value returned by dcache_gen before the path was resolved
+ */
+void dcache_insert(char *path, int inumber, unsigned long gen) {
+    ArenaMark mark = arena_mark();
+    char *key = dcache_key(path);
+
+    if (key[0] != '\0')
+        dcache_insert_key(key, inumber, gen);
+    arena_release(mark);
+}
+
+/*
+ * Removes a path from the cache. Must be called while the parent of the
+ * path is still write locked by the operation that changed it.
+ * Input:
+ *  - path: path of node
+ */
+void dcache_invalidate(char *path) {
+    ArenaMark mark = arena_mark();
+    char *key = dcache_key(path);
+    unsigned int hash = dir_hash(key);
+    DcacheShard *shard = dcache_shard(hash);
+
+    shard_lock(shard, TRUE);
+    __atomic_fetch_add(&shard->gen, 1, __ATOMIC_RELEASE);
+    for (DcacheEntry **link = &shard->buckets[hash % DCACHE_SHARD_BUCKETS]; *link; link = &(*link)->next)
+        if ((*link)->hash == hash && strcmp((*link)->path, key) == 0) {
+            shard_remove(shard, link);
+            shard->invalidations++;
+            break;
+        }
+    shard_unlock(shard);
+    arena_release(mark);
+}
+
+/*
+ * Removes a path and every path below it from the cache, used when a
+ * directory is moved. Only the generation of the path changes, entries
+ * below it find out on their next lookup (see dcache_stamp), so the cost
+ * doesn't depend on the size of the cache. The root ("") invalidates
+ * every entry. Must be called while the parent of the path is still
+ * write locked by the operation that changed it.
+ * Input:
+ *  - path: path of the directory
+ */
+void dcache_invalidate_subtree(char *path) {
+    ArenaMark mark = arena_mark();
+
+    __atomic_fetch_add(&subtree_gens[dir_hash(dcache_key(path)) % DCACHE_SUBTREE_GENS], 1, __ATOMIC_RELEASE);
+    arena_release(mark);
+    dcache_invalidate(path);
+}
+
+/*
+ * Prints the cache statistics.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void dcache_print_stats(FILE *fp) {
+    unsigned long hits = 0, misses = 0, inserts = 0, invalidations = 0, evictions = 0;
+    long entries = 0;
+
+    for (int i = 0; i < DCACHE_SHARDS; i++) {
+        shard_lock(&shards[i], FALSE);
+        hits += __atomic_load_n(&shards[i].hits, __ATOMIC_RELAXED);
+        misses += __atomic_load_n(&shards[i].misses, __ATOMIC_RELAXED);
+        inserts += shards[i].inserts;
+        invalidations += shards[i].invalidations;
+        evictions += shards[i].evictions;
+        entries += shards[i].count;
+        shard_unlock(&shards[i]);
+    }
+
+    fprintf(fp, "dcache: %ld entries, %lu hits, %lu misses, hit rate %.2f%%\n", entries, hits, misses,
+            hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    fprintf(fp, "dcache: %lu inserts, %lu invalidations, %lu evictions\n", inserts, invalidations, evictions);
+}
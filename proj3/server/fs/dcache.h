@@ -0,0 +1,51 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "../tecnicofs-api-constants.h"
+
+/* the cache is split in shards, each with its own lock and hash table */
+#define DCACHE_SHARDS 64
+#define DCACHE_SHARD_BUCKETS 512
+#define DCACHE_SHARD_MAX 1024
+
+/* generation counters of the directories whose subtrees were invalidated,
+ * shared by the paths that hash to the same one */
+#define DCACHE_SUBTREE_GENS 4096
+
+
+/*
+ * Maps a normalized path (no leading, trailing or repeated slashes) to the
+ * i-number it resolved to. The entry is only valid while the subtree
+ * generations of the path and of its ancestors add up to stamp.
+ */
+typedef struct dcacheEntry {
+	struct dcacheEntry *next;
+	unsigned int hash;
+	int inumber;
+	unsigned long stamp;
+	char path[]; /* as long as the path, in the same slab object */
+} DcacheEntry;
+
+typedef struct dcacheShard {
+	pthread_rwlock_t lock;
+	/* bumped by every invalidation, see dcache_insert */
+	unsigned long gen;
+	int count;
+	unsigned long hits, misses, inserts, invalidations, evictions;
+	DcacheEntry *buckets[DCACHE_SHARD_BUCKETS];
+} DcacheShard;
+
+
+void dcache_init();
+void dcache_destroy();
+unsigned long dcache_gen(char *path);
+unsigned long dcache_moves(char *path);
+int dcache_lookup(char *path);
+void dcache_insert(char *path, int inumber, unsigned long gen);
+void dcache_invalidate(char *path);
+void dcache_invalidate_subtree(char *path);
+void dcache_print_stats(FILE *fp);
+
+#endif /* DCACHE_H */
@@ -0,0 +1,818 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <sched.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "state.h"
+#include "directory.h"
+#include "stats.h"
+#include "reclaim.h"
+#include "slab.h"
+
+/*
+ * Hashes an entry name (32-bit FNV-1a).
+ * Input:
+ *  - name: entry name
+ * Returns: the hash of the name
+ */
+unsigned int dir_hash(char *name) {
+    unsigned int hash = 2166136261u;
+
+    for (unsigned char *c = (unsigned char*)name; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Returns the i-th Bloom filter counter of a name hash. The hash is mixed
+ * first, as its low bits already pick the bucket.
+ */
+static unsigned int bloom_index(DirTable *table, unsigned int hash, int i) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    /* double hashing, the step is odd so probes never repeat */
+    return (hash + i * ((hash >> 11) | 1)) & (table->size * DIR_BLOOM_COUNTERS - 1);
+}
+
+/*
+ * Adds (delta = 1) or removes (delta = -1) a name hash from the filter.
+ * Saturated counters are never decremented, as they may hide other names.
+ */
+static void bloom_update(DirTable *table, unsigned int hash, int delta) {
+    for (int i = 0; i < DIR_BLOOM_PROBES; i++) {
+        unsigned char *counter = &table->bloom[bloom_index(table, hash, i)];
+        /* lookups read the counters without the stripe lock */
+        if (*counter != DIR_BLOOM_MAX)
+            __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Returns: FALSE if the name is surely not in the table, TRUE if it may be
+ */
+static int bloom_maybe(DirTable *table, unsigned int hash) {
+    for (int i = 0; i < DIR_BLOOM_PROBES; i++)
+        if (__atomic_load_n(&table->bloom[bloom_index(table, hash, i)], __ATOMIC_RELAXED) == 0)
+            return FALSE;
+    return TRUE;
+}
+
+/*
+ * Allocates an empty hash table.
+ * Input:
+ *  - size: number of buckets, a power of two
+ * Returns: pointer to the table
+ */
+static DirTable *table_create(unsigned int size) {
+    DirTable *table = slab_calloc(sizeof(DirTable) + size * sizeof(DirEntry*) + size * DIR_BLOOM_COUNTERS);
+
+    table->size = size;
+    table->bloom = (unsigned char*)&table->buckets[size];
+    return table;
+}
+
+/*
+ * Frees a table and every entry still in it.
+ */
+static void table_destroy(DirTable *table) {
+    for (unsigned int i = 0; i < table->size; i++) {
+        DirEntry *entry = table->buckets[i], *next;
+        for (; entry; entry = next) {
+            next = entry->next;
+            reclaim_free(entry);
+        }
+    }
+    reclaim_free(table);
+}
+
+/*
+ * Looks for an entry in a table.
+ * Links are read atomically, as optimistic readers (see lookup) may run
+ * this while a writer changes the table; they validate the result later.
+ * Returns: pointer to the link that points to the entry, or NULL
+ */
+static DirEntry **table_find(DirTable *table, unsigned int hash, char *name, unsigned int len) {
+    DirEntry **link = &table->buckets[hash & (table->size - 1)], *entry;
+
+    for (; (entry = __atomic_load_n(link, __ATOMIC_ACQUIRE)); link = &entry->next)
+        if (entry->hash == hash && entry->len == len && memcmp(entry->name, name, len) == 0)
+            return link;
+    return NULL;
+}
+
+/*
+ * Returns the stripe that holds a name hash. The stripe is picked by the
+ * high bits, as the low ones pick the bucket.
+ */
+static DirStripe *dir_stripe(DirStripe *stripes, unsigned int hash) {
+    return &stripes[hash >> (32 - DIR_STRIPE_BITS)];
+}
+
+/*
+ * Takes a stripe or inline entries lock. Critical sections are a few
+ * pointer updates, so the lock spins for a while before yielding the CPU.
+ */
+static void spin_lock(int *lock) {
+    for (int spins = 0; __atomic_exchange_n(lock, TRUE, __ATOMIC_ACQUIRE); spins++)
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+            if (++spins > 100)
+                sched_yield();
+}
+
+static void spin_unlock(int *lock) {
+    __atomic_store_n(lock, FALSE, __ATOMIC_RELEASE);
+}
+
+/*
+ * Marks a locked stripe or inline entries as being changed (odd version)
+ * for optimistic readers, or as stable again.
+ */
+static void write_begin(unsigned int *version) {
+    __atomic_store_n(version, *version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void write_end(unsigned int *version) {
+    __atomic_store_n(version, *version + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Starts a read of a stripe or inline entries without their lock, waiting
+ * while a writer changes them.
+ * Returns: their version, to check with read_retry
+ */
+static unsigned int read_begin(unsigned int *version) {
+    unsigned int start;
+
+    for (int spins = 0; (start = __atomic_load_n(version, __ATOMIC_ACQUIRE)) & 1; )
+        if (++spins > 100)
+            sched_yield();
+    return start;
+}
+
+/*
+ * Returns: TRUE if a writer changed what was read since read_begin
+ */
+static int read_retry(unsigned int *version, unsigned int start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(version, __ATOMIC_RELAXED) != start;
+}
+
+/*
+ * Moves a few buckets from the old table to the new one, finishing the
+ * resize when the old table is empty. The stripe must be locked.
+ * Input:
+ *  - stripe: stripe being resized
+ *  - steps: number of non-empty buckets to move
+ */
+static void stripe_rehash_step(DirStripe *stripe, int steps) {
+    DirTable *from = stripe->table[0], *to = stripe->table[1];
+    /* bound the number of empty buckets visited per step */
+    int empty_visits = steps * 10;
+
+    while (steps > 0 && stripe->rehashidx < from->size) {
+        DirEntry *entry = from->buckets[stripe->rehashidx], *next;
+
+        if (!entry) {
+            stripe->rehashidx++;
+            if (--empty_visits == 0)
+                return;
+            continue;
+        }
+
+        for (; entry; entry = next) {
+            next = entry->next;
+            __atomic_store_n(&entry->next, to->buckets[entry->hash & (to->size - 1)], __ATOMIC_RELEASE);
+            __atomic_store_n(&to->buckets[entry->hash & (to->size - 1)], entry, __ATOMIC_RELEASE);
+            bloom_update(from, entry->hash, -1);
+            bloom_update(to, entry->hash, 1);
+            from->used--;
+            to->used++;
+        }
+        __atomic_store_n(&from->buckets[stripe->rehashidx++], NULL, __ATOMIC_RELEASE);
+        steps--;
+    }
+
+    if (stripe->rehashidx == from->size) {
+        __atomic_store_n(&stripe->table[0], to, __ATOMIC_RELEASE);
+        __atomic_store_n(&stripe->table[1], NULL, __ATOMIC_RELEASE);
+        stripe->rehashidx = -1;
+        reclaim_free(from);
+    }
+}
+
+/*
+ * Looks for a name in a stripe, without locking it. Nothing is counted, as
+ * lookups that are retried or that only check an insert would count the
+ * same name more than once (see directory_count_probe).
+ * Input:
+ *  - probe: receives what the filters and tables answered
+ * Returns:
+ *  - inumber: the entry's i-number
+ *  - FAIL: if not found
+ */
+static int stripe_find(DirStripe *stripe, unsigned int hash, char *name, unsigned int len, DirProbe *probe) {
+    DirEntry **link, *entry;
+
+    *probe = DIR_PROBE_NEGATIVE;
+    for (int t = 0; t < 2; t++) {
+        DirTable *table = __atomic_load_n(&stripe->table[t], __ATOMIC_ACQUIRE);
+
+        if (!table)
+            break;
+        if (!bloom_maybe(table, hash))
+            continue;
+        *probe = DIR_PROBE_FALSE_POSITIVE;
+        /* the link is read again, an optimistic reader may see it change */
+        if ((link = table_find(table, hash, name, len)) && (entry = __atomic_load_n(link, __ATOMIC_ACQUIRE))) {
+            *probe = DIR_PROBE_HIT;
+            return entry->inumber;
+        }
+    }
+    return FAIL;
+}
+
+/*
+ * Adds an entry that is not in a locked stripe yet, starting a resize if
+ * the stripe is too loaded.
+ */
+static void stripe_add(DirStripe *stripe, DirEntry *entry) {
+    write_begin(&stripe->version);
+
+    if (!stripe->table[0])
+        __atomic_store_n(&stripe->table[0], table_create(DIR_INITIAL_BUCKETS), __ATOMIC_RELEASE);
+    else if (stripe->rehashidx != -1)
+        stripe_rehash_step(stripe, DIR_REHASH_STEP);
+    else if (stripe->count >= stripe->table[0]->size * DIR_MAX_LOAD) {
+        __atomic_store_n(&stripe->table[1], table_create(stripe->table[0]->size * 2), __ATOMIC_RELEASE);
+        stripe->rehashidx = 0;
+    }
+
+    /* while resizing new entries go straight to the new table */
+    DirTable *table = stripe->table[stripe->rehashidx != -1 ? 1 : 0];
+    DirEntry **bucket = &table->buckets[entry->hash & (table->size - 1)];
+
+    entry->next = *bucket;
+    __atomic_store_n(bucket, entry, __ATOMIC_RELEASE);
+    bloom_update(table, entry->hash, 1);
+    table->used++;
+    stripe->count++;
+
+    write_end(&stripe->version);
+}
+
+/*
+ * Allocates an entry for the stripe tables, just big enough for its name.
+ */
+static DirEntry *entry_create(unsigned int hash, char *name, unsigned int len, int inumber) {
+    DirEntry *entry = slab_alloc(offsetof(DirEntry, name) + len + 1);
+
+    entry->hash = hash;
+    entry->inumber = inumber;
+    entry->len = len;
+    memcpy(entry->name, name, len + 1);
+    return entry;
+}
+
+/*
+ * Compares a name hash with the hashes of all the inline slots, free ones
+ * included.
+ * Returns: bitmap of the slots with that hash
+ */
+static unsigned int match_scalar(const unsigned int *hashes, unsigned int hash) {
+    unsigned int match = 0;
+
+    for (int i = 0; i < DIR_INLINE_ENTRIES; i++)
+        match |= (unsigned int)(hashes[i] == hash) << i;
+    return match;
+}
+
+#if defined(__x86_64__)
+static unsigned int match_sse2(const unsigned int *hashes, unsigned int hash) {
+    __m128i key = _mm_set1_epi32(hash);
+    unsigned int match = 0;
+
+    for (int i = 0; i < DIR_INLINE_ENTRIES; i += 4) {
+        __m128i group = _mm_loadu_si128((const __m128i*)&hashes[i]);
+        match |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(group, key))) << i;
+    }
+    return match;
+}
+
+__attribute__((target("avx2")))
+static unsigned int match_avx2(const unsigned int *hashes, unsigned int hash) {
+    __m256i key = _mm256_set1_epi32(hash);
+    unsigned int match = 0;
+
+    for (int i = 0; i < DIR_INLINE_ENTRIES; i += 8) {
+        __m256i group = _mm256_loadu_si256((const __m256i*)&hashes[i]);
+        match |= (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(group, key))) << i;
+    }
+    return match;
+}
+#endif
+
+static unsigned int match_resolve(const unsigned int *hashes, unsigned int hash);
+
+static char *scan_names[NDIRSCANS] = {"scalar", "sse2", "avx2"};
+static unsigned int (*scan_kernels[NDIRSCANS])(const unsigned int*, unsigned int) = {
+#if defined(__x86_64__)
+    match_scalar, match_sse2, match_avx2
+#else
+    match_scalar, NULL, NULL
+#endif
+};
+
+/* kernel used by lookups, picked on the first one if not set before */
+static unsigned int (*match_hashes)(const unsigned int*, unsigned int) = match_resolve;
+static DirScan scan_current = DIR_SCAN_SCALAR;
+
+/*
+ * Returns: the fastest kernel the CPU supports
+ */
+DirScan directory_best_scan() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+        return DIR_SCAN_AVX2;
+    return DIR_SCAN_SSE2;
+#else
+    return DIR_SCAN_SCALAR;
+#endif
+}
+
+/*
+ * Selects the kernel that compares name hashes with the inline entries.
+ * Input:
+ *  - scan: kernel to use
+ * Returns: SUCCESS, or FAIL if it isn't built or the CPU doesn't support it
+ */
+int directory_set_scan(DirScan scan) {
+    if (scan < 0 || scan >= NDIRSCANS || !scan_kernels[scan] ||
+        (scan == DIR_SCAN_AVX2 && directory_best_scan() != DIR_SCAN_AVX2))
+        return FAIL;
+    scan_current = scan;
+    __atomic_store_n(&match_hashes, scan_kernels[scan], __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+char *directory_scan_name(DirScan scan) {
+    return scan_names[scan];
+}
+
+static unsigned int match_resolve(const unsigned int *hashes, unsigned int hash) {
+    directory_set_scan(directory_best_scan());
+    return match_hashes(hashes, hash);
+}
+
+/*
+ * Looks for a name among the inline entries, without locking them. Only
+ * the slots in use whose hash matches have their name compared.
+ * Returns: index of the entry, or FAIL if not found
+ */
+static int inline_find(Directory *dir, unsigned int hash, char *name) {
+    unsigned int used = __atomic_load_n(&dir->used, __ATOMIC_ACQUIRE);
+    unsigned int match = match_hashes(dir->hashes, hash) & used;
+
+    for (; match; match &= match - 1) {
+        int i = __builtin_ctz(match);
+
+        if (strcmp(dir->names[i], name) == 0)
+            return i;
+    }
+    return FAIL;
+}
+
+/*
+ * Moves the inline entries of a directory to stripe tables. Its inline
+ * lock must be held. The inline version changes, so optimistic readers
+ * that started before the spill retry.
+ * Returns: the stripes
+ */
+static DirStripe *dir_spill(Directory *dir) {
+    DirStripe *stripes = slab_alloc(DIR_STRIPES * sizeof(DirStripe));
+
+    for (int i = 0; i < DIR_STRIPES; i++) {
+        stripes[i].table[0] = stripes[i].table[1] = NULL;
+        stripes[i].rehashidx = -1;
+        stripes[i].count = 0;
+        stripes[i].lock = FALSE;
+        stripes[i].version = 0;
+    }
+
+    for (unsigned int used = dir->used; used; used &= used - 1) {
+        int i = __builtin_ctz(used);
+
+        stripe_add(dir_stripe(stripes, dir->hashes[i]),
+                   entry_create(dir->hashes[i], dir->names[i], strlen(dir->names[i]), dir->inumbers[i]));
+    }
+
+    write_begin(&dir->version);
+    __atomic_store_n(&dir->stripes, stripes, __ATOMIC_RELEASE);
+    write_end(&dir->version);
+    stats_add(STAT_DIR_SPILLS, 1);
+    return stripes;
+}
+
+/*
+ * Returns the stripes of a directory, or NULL with its inline lock held if
+ * its entries are still inline.
+ */
+static DirStripe *dir_lock_inline(Directory *dir) {
+    DirStripe *stripes = __atomic_load_n(&dir->stripes, __ATOMIC_ACQUIRE);
+
+    if (stripes)
+        return stripes;
+
+    spin_lock(&dir->lock);
+    /* a spill may have happened while waiting for the lock */
+    if ((stripes = dir->stripes))
+        spin_unlock(&dir->lock);
+    return stripes;
+}
+
+/*
+ * Creates an empty directory.
+ * Returns: pointer to the directory
+ */
+Directory *directory_create() {
+    Directory *dir = slab_alloc(sizeof(Directory));
+
+    dir->lock = FALSE;
+    dir->version = 0;
+    dir->stripes = NULL;
+    dir->used = 0;
+    memset(dir->hashes, 0, sizeof(dir->hashes));
+    memset(dir->names, '\0', sizeof(dir->names));
+    for (int i = 0; i < DIR_INLINE_ENTRIES; i++)
+        dir->inumbers[i] = FREE_INODE;
+    return dir;
+}
+
+/*
+ * Frees a directory and all its entries.
+ */
+void directory_destroy(Directory *dir) {
+    if (dir->stripes) {
+        for (int i = 0; i < DIR_STRIPES; i++)
+            for (int t = 0; t < 2; t++)
+                if (dir->stripes[i].table[t])
+                    table_destroy(dir->stripes[i].table[t]);
+        reclaim_free(dir->stripes);
+    }
+    reclaim_free(dir);
+}
+
+/*
+ * Looks for an entry by name, see directory_lookup.
+ * Input:
+ *  - dir: directory
+ *  - name: entry name
+ *  - probe: receives what the lookup needed, see directory_count_probe
+ * Returns:
+ *  - inumber: the entry's i-number
+ *  - FAIL: if not found
+ */
+static int dir_lookup(Directory *dir, char *name, DirProbe *probe) {
+    unsigned int hash = dir_hash(name), version;
+    DirStripe *stripes;
+    int inumber;
+
+    /* neither the inline entries nor the stripes are locked, so lookups
+     * of names in the same directory don't write to it */
+    do {
+        version = read_begin(&dir->version);
+        if ((stripes = __atomic_load_n(&dir->stripes, __ATOMIC_ACQUIRE)))
+            break;
+
+        int i = inline_find(dir, hash, name);
+        inumber = i == FAIL ? FAIL : __atomic_load_n(&dir->inumbers[i], __ATOMIC_RELAXED);
+    } while (read_retry(&dir->version, version));
+
+    *probe = DIR_PROBE_INLINE;
+    if (!stripes)
+        return inumber;
+
+    /* a directory never goes back inline, so only the stripe is checked
+     * from here on; removed entries and old tables are only freed once
+     * the lookup is out of the read section */
+    DirStripe *stripe = dir_stripe(stripes, hash);
+    unsigned int len = strlen(name);
+
+    reclaim_enter();
+    do {
+        version = read_begin(&stripe->version);
+        inumber = stripe_find(stripe, hash, name, len, probe);
+    } while (read_retry(&stripe->version, version));
+    reclaim_exit();
+
+    return inumber;
+}
+
+/*
+ * Looks for an entry by name. Callers must keep the directory from being
+ * destroyed, but not from changing.
+ * Input:
+ *  - dir: directory
+ *  - name: entry name
+ * Returns:
+ *  - inumber: the entry's i-number
+ *  - FAIL: if not found
+ */
+int directory_lookup(Directory *dir, char *name) {
+    DirProbe probe;
+    int inumber = dir_lookup(dir, name, &probe);
+
+    directory_count_probe(probe);
+    return inumber;
+}
+
+/*
+ * Same as directory_lookup, for a name the operation already looked up
+ * in the directory and checks again after waiting for a lock, so that its
+ * Bloom filter probe isn't counted twice.
+ */
+int directory_lookup_again(Directory *dir, char *name) {
+    DirProbe probe;
+
+    return dir_lookup(dir, name, &probe);
+}
+
+/*
+ * Looks for an entry by name without locking, for optimistic readers: the
+ * result is only meaningful if directory_read_validate succeeds later, and
+ * only then should the probe be counted.
+ * Must be called inside a reclaim_enter/reclaim_exit section.
+ * Input:
+ *  - dir: directory
+ *  - name: entry name
+ *  - probe: receives what the lookup needed, see directory_count_probe
+ * Returns:
+ *  - inumber: the entry's i-number
+ *  - FAIL: if not found
+ */
+int directory_peek(Directory *dir, char *name, DirProbe *probe) {
+    unsigned int hash = dir_hash(name);
+    DirStripe *stripes = __atomic_load_n(&dir->stripes, __ATOMIC_ACQUIRE);
+
+    if (stripes)
+        return stripe_find(dir_stripe(stripes, hash), hash, name, strlen(name), probe);
+
+    *probe = DIR_PROBE_INLINE;
+    int i = inline_find(dir, hash, name);
+    return i == FAIL ? FAIL : __atomic_load_n(&dir->inumbers[i], __ATOMIC_RELAXED);
+}
+
+/*
+ * Counts the Bloom filter outcome of a completed lookup, once per lookup,
+ * so that the false positive rate reports lookup misses only.
+ */
+void directory_count_probe(DirProbe probe) {
+    switch (probe) {
+        case DIR_PROBE_NEGATIVE:
+            stats_add(STAT_BLOOM_NEGATIVE, 1);
+            break;
+        case DIR_PROBE_FALSE_POSITIVE:
+            stats_add(STAT_BLOOM_FALSE_POSITIVE, 1);
+            break;
+        case DIR_PROBE_HIT:
+            stats_add(STAT_BLOOM_TRUE_POSITIVE, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Returns the inline version of a directory in the high half and the
+ * version of the stripe that holds a name hash, if it spilled, in the low
+ * half. Odd if either of them is.
+ */
+static unsigned long dir_version(Directory *dir, unsigned int hash) {
+    unsigned int version = __atomic_load_n(&dir->version, __ATOMIC_ACQUIRE);
+    DirStripe *stripes = __atomic_load_n(&dir->stripes, __ATOMIC_ACQUIRE);
+    unsigned int stripe_version = stripes ?
+        __atomic_load_n(&dir_stripe(stripes, hash)->version, __ATOMIC_ACQUIRE) : 0;
+
+    return (unsigned long)version << 32 | stripe_version | (version & 1);
+}
+
+/*
+ * Starts an optimistic read of the entries where a name would be.
+ * Returns: their version, odd if they are being changed
+ */
+unsigned long directory_read_begin(Directory *dir, char *name) {
+    return dir_version(dir, dir_hash(name));
+}
+
+/*
+ * Checks that the entries where a name would be didn't change since
+ * directory_read_begin.
+ * Returns: TRUE or FALSE
+ */
+int directory_read_validate(Directory *dir, char *name, unsigned long version) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(version & 1) && dir_version(dir, dir_hash(name)) == version;
+}
+
+/*
+ * Adds an entry, inline while it fits and otherwise to its stripe.
+ * Input:
+ *  - dir: directory
+ *  - name: entry name
+ *  - inumber: i-number of the entry
+ * Returns: SUCCESS, or FAIL if the name already exists
+ */
+int directory_insert(Directory *dir, char *name, int inumber) {
+    unsigned int hash = dir_hash(name), len = strlen(name);
+    DirStripe *stripes = dir_lock_inline(dir);
+
+    if (!stripes) {
+        /* checked under the lock, as creates of the same name may race */
+        if (inline_find(dir, hash, name) != FAIL) {
+            spin_unlock(&dir->lock);
+            return FAIL;
+        }
+
+        if (__builtin_popcount(dir->used) < DIR_INLINE_ENTRIES && len < DIR_INLINE_NAME) {
+            int i = __builtin_ctz(~dir->used);
+
+            write_begin(&dir->version);
+            dir->hashes[i] = hash;
+            strcpy(dir->names[i], name);
+            dir->inumbers[i] = inumber;
+            /* the slot is only seen by lookups once it is complete */
+            __atomic_store_n(&dir->used, dir->used | 1u << i, __ATOMIC_RELEASE);
+            write_end(&dir->version);
+
+            spin_unlock(&dir->lock);
+            return SUCCESS;
+        }
+
+        stripes = dir_spill(dir);
+        spin_unlock(&dir->lock);
+    }
+
+    DirEntry *entry = entry_create(hash, name, len, inumber);
+    DirStripe *stripe = dir_stripe(stripes, hash);
+    DirProbe probe;
+
+    spin_lock(&stripe->lock);
+
+    if (stripe_find(stripe, hash, name, len, &probe) != FAIL) {
+        spin_unlock(&stripe->lock);
+        slab_free(entry);
+        return FAIL;
+    }
+
+    stripe_add(stripe, entry);
+    spin_unlock(&stripe->lock);
+    return SUCCESS;
+}
+
+/*
+ * Removes an entry.
+ * Input:
+ *  - dir: directory
+ *  - name: entry name
+ *  - inumber: expected i-number of the entry
+ * Returns: SUCCESS or FAIL
+ */
+int directory_remove(Directory *dir, char *name, int inumber) {
+    unsigned int hash = dir_hash(name), len = strlen(name);
+    DirStripe *stripes = dir_lock_inline(dir);
+    DirEntry **link;
+    int res = FAIL;
+
+    if (!stripes) {
+        int i = inline_find(dir, hash, name);
+
+        if (i != FAIL && dir->inumbers[i] == inumber) {
+            write_begin(&dir->version);
+            __atomic_store_n(&dir->used, dir->used & ~(1u << i), __ATOMIC_RELEASE);
+            write_end(&dir->version);
+            res = SUCCESS;
+        }
+        spin_unlock(&dir->lock);
+        return res;
+    }
+
+    DirStripe *stripe = dir_stripe(stripes, hash);
+
+    spin_lock(&stripe->lock);
+    write_begin(&stripe->version);
+
+    for (int t = 0; t < 2 && stripe->table[t]; t++)
+        if ((link = table_find(stripe->table[t], hash, name, len)) && (*link)->inumber == inumber) {
+            DirEntry *entry = *link;
+            __atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
+            bloom_update(stripe->table[t], hash, -1);
+            reclaim_free(entry);
+            stripe->table[t]->used--;
+            stripe->count--;
+
+            if (stripe->rehashidx != -1)
+                stripe_rehash_step(stripe, DIR_REHASH_STEP);
+            res = SUCCESS;
+            break;
+        }
+
+    write_end(&stripe->version);
+    spin_unlock(&stripe->lock);
+    return res;
+}
+
+/*
+ * Returns the number of entries in the directory.
+ */
+int directory_count(Directory *dir) {
+    int count = 0;
+
+    if (!dir->stripes)
+        return __builtin_popcount(dir->used);
+    for (int i = 0; i < DIR_STRIPES; i++)
+        count += dir->stripes[i].count;
+    return count;
+}
+
+/*
+ * Starts an iteration over all the entries of a directory.
+ * The directory must not change during the iteration.
+ */
+void directory_iter_init(DirIterator *it, Directory *dir) {
+    it->dir = dir;
+    it->slot = 0;
+    it->stripe = 0;
+    it->table = 0;
+    it->bucket = 0;
+    it->entry = NULL;
+}
+
+/*
+ * Returns: the next entry, or NULL when there are no more. Inline entries
+ * are returned as a copy, valid until the next call.
+ */
+DirEntry *directory_iter_next(DirIterator *it) {
+    if (!it->dir->stripes) {
+        while (it->slot < DIR_INLINE_ENTRIES) {
+            int i = it->slot++;
+
+            if (it->dir->used & 1u << i) {
+                DirEntry *copy = &it->inline_copy.entry;
+
+                copy->next = NULL;
+                copy->hash = it->dir->hashes[i];
+                copy->inumber = it->dir->inumbers[i];
+                copy->len = strlen(it->dir->names[i]);
+                memcpy(copy->name, it->dir->names[i], copy->len + 1);
+                return copy;
+            }
+        }
+        return NULL;
+    }
+
+    if (it->entry)
+        it->entry = it->entry->next;
+
+    while (!it->entry) {
+        if (it->stripe == DIR_STRIPES)
+            return NULL;
+
+        DirTable *table = it->table < 2 ? it->dir->stripes[it->stripe].table[it->table] : NULL;
+
+        if (!table || it->bucket == table->size) {
+            if (!table || ++it->table == 2) {
+                it->stripe++;
+                it->table = 0;
+            }
+            it->bucket = 0;
+            continue;
+        }
+        it->entry = table->buckets[it->bucket++];
+    }
+    return it->entry;
+}
+
+/*
+ * Prints the Bloom filter and spill statistics.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void directory_print_stats(FILE *fp) {
+    unsigned long negative = stats_get(STAT_BLOOM_NEGATIVE);
+    unsigned long false_positive = stats_get(STAT_BLOOM_FALSE_POSITIVE);
+    unsigned long true_positive = stats_get(STAT_BLOOM_TRUE_POSITIVE);
+
+    fprintf(fp, "bloom: %lu hits, %lu misses without scan, %lu false positives, false positive rate %.2f%%\n",
+            true_positive, negative, false_positive,
+            negative + false_positive ? 100.0 * false_positive / (negative + false_positive) : 0.0);
+    fprintf(fp, "directory: %lu spills of inline entries to stripe tables, %s inline scan\n",
+            stats_get(STAT_DIR_SPILLS), scan_names[scan_current]);
+}
@@ -0,0 +1,147 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stdio.h>
+#include "../tecnicofs-api-constants.h"
+
+/* entries kept inside the directory itself (a multiple of 8, for the scan
+ * kernels, up to 32, for the occupancy bitmap), and the longest name they hold */
+#define DIR_INLINE_ENTRIES 8
+#define DIR_INLINE_NAME 16
+
+/* entries are spread by name hash over independently locked stripes */
+#define DIR_STRIPE_BITS 3
+#define DIR_STRIPES (1 << DIR_STRIPE_BITS)
+
+/* buckets of a new stripe table and maximum entries per bucket before growing */
+#define DIR_INITIAL_BUCKETS 4
+#define DIR_MAX_LOAD 2
+
+/* buckets moved to the new table by each insert/remove while resizing */
+#define DIR_REHASH_STEP 4
+
+/* counting Bloom filter of each table: counters per bucket and probes */
+#define DIR_BLOOM_COUNTERS 16
+#define DIR_BLOOM_PROBES 2
+#define DIR_BLOOM_MAX 255
+
+
+/*
+ * Contains the name of the entry, its hash and respective i-number. The
+ * name is stored right after the record, in the same allocation, so an
+ * entry only takes the bytes its name needs and names have no length cap.
+ */
+typedef struct dirEntry {
+	struct dirEntry *next;
+	unsigned int hash;
+	int inumber;
+	unsigned int len; /* length of the name, without terminator */
+	char name[];
+} DirEntry;
+
+/*
+ * Chained hash table, size is always a power of two. Its entries are also
+ * counted in a Bloom filter (size * DIR_BLOOM_COUNTERS counters, stored
+ * after the buckets) so that most misses don't touch the buckets.
+ */
+typedef struct dirTable {
+	unsigned int size;
+	unsigned int used;
+	unsigned char *bloom;
+	DirEntry *buckets[];
+} DirTable;
+
+/*
+ * Entries of a directory whose names hash to the same stripe. While
+ * resizing, entries are moved a few buckets at a time from table[0] to
+ * table[1], so a large stripe is never rehashed in one go. count is the
+ * number of live entries in both tables. Tables are only allocated on the
+ * first insert.
+ */
+typedef struct dirStripe {
+	DirTable *table[2];
+	long rehashidx; /* next bucket of table[0] to move, -1 if not resizing */
+	int count;
+	int lock; /* spinlock held while the stripe is changed */
+	unsigned int version; /* odd while the stripe is being changed */
+} DirStripe;
+
+/*
+ * Directory contents. Most directories hold a few short names, so they
+ * start with DIR_INLINE_ENTRIES entries inside the directory, and a
+ * lookup reads them without following any other pointer or taking a lock.
+ * When an entry doesn't fit there, all of them move to DIR_STRIPES stripe
+ * tables for good (a spill). Inserts and removes only lock the stripe of
+ * the name, or the inline entries, so callers may change different names
+ * of the same directory at the same time while holding the directory's
+ * i-node read locked. Whatever needs the whole directory (counting,
+ * iterating, destroying) requires the i-node to be write locked.
+ */
+typedef struct directory {
+	int lock; /* spinlock held while the inline entries change or spill */
+	unsigned int version; /* odd while the inline entries change or spill */
+	DirStripe *stripes; /* NULL until the directory spills */
+	unsigned int used; /* bitmap of the inline slots in use */
+	/* inline entries, one array per field so that a lookup compares the
+	 * hashes of all of them at once (see directory_set_scan) */
+	unsigned int hashes[DIR_INLINE_ENTRIES];
+	int inumbers[DIR_INLINE_ENTRIES];
+	char names[DIR_INLINE_ENTRIES][DIR_INLINE_NAME]; /* always terminated */
+} Directory;
+
+/*
+ * Kernels that compare a name hash with the hashes of the inline entries
+ */
+typedef enum dirScan {
+	DIR_SCAN_SCALAR,
+	DIR_SCAN_SSE2,  /* 4 hashes per instruction */
+	DIR_SCAN_AVX2,  /* 8 hashes per instruction */
+	NDIRSCANS
+} DirScan;
+
+/*
+ * What a lookup needed to find out whether a name is in a directory, see
+ * directory_count_probe
+ */
+typedef enum dirProbe {
+	DIR_PROBE_INLINE,         /* the inline entries, not counted */
+	DIR_PROBE_NEGATIVE,       /* a miss answered by the Bloom filters alone */
+	DIR_PROBE_FALSE_POSITIVE, /* a miss that still needed a scan */
+	DIR_PROBE_HIT
+} DirProbe;
+
+typedef struct dirIterator {
+	Directory *dir;
+	int slot;
+	int stripe;
+	int table;
+	unsigned int bucket;
+	DirEntry *entry;
+	/* copy of the current inline entry, with room for its name */
+	union {
+		DirEntry entry;
+		char bytes[sizeof(DirEntry) + DIR_INLINE_NAME];
+	} inline_copy;
+} DirIterator;
+
+
+unsigned int dir_hash(char *name);
+Directory *directory_create();
+void directory_destroy(Directory *dir);
+int directory_lookup(Directory *dir, char *name);
+int directory_lookup_again(Directory *dir, char *name);
+int directory_peek(Directory *dir, char *name, DirProbe *probe);
+void directory_count_probe(DirProbe probe);
+unsigned long directory_read_begin(Directory *dir, char *name);
+int directory_read_validate(Directory *dir, char *name, unsigned long version);
+int directory_insert(Directory *dir, char *name, int inumber);
+int directory_remove(Directory *dir, char *name, int inumber);
+int directory_count(Directory *dir);
+void directory_iter_init(DirIterator *it, Directory *dir);
+DirEntry *directory_iter_next(DirIterator *it);
+DirScan directory_best_scan();
+int directory_set_scan(DirScan scan);
+char *directory_scan_name(DirScan scan);
+void directory_print_stats(FILE *fp);
+
+#endif /* DIRECTORY_H */
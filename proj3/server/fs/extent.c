@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "extent.h"
+#include "slab.h"
+#include "stats.h"
+
+#define FALSE 0
+#define TRUE 1
+
+/* regions blocks are carved from, released by extent_pool_destroy */
+static char **regions = NULL, *region_next = NULL, *region_end = NULL;
+static int region_count = 0, region_max = 0;
+/* freed blocks, linked through their first word */
+static void *free_blocks = NULL;
+static unsigned long blocks_used = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void mutex_lock(pthread_mutex_t *lock) {
+    if (pthread_mutex_lock(lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void mutex_unlock(pthread_mutex_t *lock) {
+    if (pthread_mutex_unlock(lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Takes a block from the pool, mapping a new region once it is used up.
+ * Unlike the slab there are no per-thread caches: each block is filled
+ * with EXTENT_BLOCK_SIZE bytes of data, which cost far more than the lock.
+ * Returns: pointer to the block, with undefined contents
+ */
+static char *block_alloc() {
+    char *block;
+
+    mutex_lock(&pool_lock);
+
+    if (free_blocks) {
+        block = free_blocks;
+        free_blocks = *(void**)block;
+    }
+    else {
+        if (region_next == region_end) {
+            if (region_count == region_max) {
+                region_max = region_max ? 2 * region_max : 16;
+                if (!(regions = realloc(regions, region_max * sizeof(char*)))) {
+                    fprintf(stderr, "Error: memory allocation failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            region_next = regions[region_count++] = hugepage_alloc(EXTENT_REGION_SIZE);
+            region_end = region_next + EXTENT_REGION_SIZE;
+            stats_add(STAT_SYSTEM_ALLOCS, 1);
+        }
+        block = region_next;
+        region_next += EXTENT_BLOCK_SIZE;
+    }
+    blocks_used++;
+
+    mutex_unlock(&pool_lock);
+    return block;
+}
+
+/*
+ * Returns a block to the pool.
+ */
+static void block_free(void *block) {
+    mutex_lock(&pool_lock);
+    *(void**)block = free_blocks;
+    free_blocks = block;
+    blocks_used--;
+    mutex_unlock(&pool_lock);
+}
+
+/*
+ * Returns: the number of blocks a map with the given levels can index
+ */
+static unsigned long map_capacity(int levels) {
+    return 1UL << (levels * EXTENT_FANOUT_SHIFT);
+}
+
+/*
+ * Adds levels on top of a map until it can index a block.
+ * Input:
+ *  - map: the map
+ *  - index: number of the block in the file
+ */
+static void map_grow(ExtentMap *map, unsigned long index) {
+    while (index >= map_capacity(map->levels)) {
+        if (map->root) {
+            ExtentNode *node = slab_calloc(sizeof(ExtentNode));
+
+            node->slots[0] = map->root;
+            map->root = node;
+        }
+        map->levels++;
+    }
+}
+
+/*
+ * Sets an empty slot, unless a writer of another range sets it first.
+ * Input:
+ *  - slot: the slot
+ *  - ptr: node or block for it, freed if it is not used
+ *  - level: of ptr, 0 for a block
+ * Returns: what the slot points to
+ */
+static void *slot_install(void **slot, void *ptr, int level) {
+    void *current = NULL;
+
+    if (__atomic_compare_exchange_n(slot, &current, ptr, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return ptr;
+    if (level > 0)
+        slab_free(ptr);
+    else
+        block_free(ptr);
+    return current;
+}
+
+/*
+ * Finds the slot that points to a block of a map.
+ * Input:
+ *  - map: the map, able to index the block (see map_grow)
+ *  - index: number of the block in the file
+ *  - create: TRUE to add the missing nodes on the way
+ * Returns: pointer to the slot, or NULL if a node is missing
+ */
+static void **map_slot(ExtentMap *map, unsigned long index, int create) {
+    void **slot = &map->root;
+
+    for (int level = map->levels; level > 0; level--) {
+        void *node = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+        if (!node) {
+            if (!create)
+                return NULL;
+            node = slot_install(slot, slab_calloc(sizeof(ExtentNode)), level);
+        }
+        slot = &((ExtentNode*)node)->slots[(index >> ((level - 1) * EXTENT_FANOUT_SHIFT)) & (EXTENT_FANOUT - 1)];
+    }
+    return slot;
+}
+
+/*
+ * Frees the blocks of a subtree from a given one on, and the nodes that
+ * are left empty.
+ * Input:
+ *  - slot: points to the subtree, cleared if all of it is freed
+ *  - level: of the subtree, 0 for a single block
+ *  - first: first block to free, counted from the start of the subtree
+ */
+static void subtree_free(void **slot, int level, unsigned long first) {
+    if (!*slot)
+        return;
+
+    if (level > 0) {
+        ExtentNode *node = *slot;
+        int shift = (level - 1) * EXTENT_FANOUT_SHIFT;
+        unsigned long i = first >> shift;
+
+        subtree_free(&node->slots[i], level - 1, first & ((1UL << shift) - 1));
+        while (++i < EXTENT_FANOUT)
+            subtree_free(&node->slots[i], level - 1, 0);
+    }
+
+    if (first == 0) {
+        if (level > 0)
+            slab_free(*slot);
+        else
+            block_free(*slot);
+        *slot = NULL;
+    }
+}
+
+/*
+ * Frees the nodes of a subtree that index no block.
+ * Input:
+ *  - slot: points to the subtree, cleared if all of it is freed
+ *  - level: of the subtree, 0 for a single block
+ * Returns: TRUE if the subtree was empty
+ */
+static int subtree_prune(void **slot, int level) {
+    if (!*slot)
+        return TRUE;
+    if (level == 0)
+        return FALSE;
+
+    ExtentNode *node = *slot;
+    int empty = TRUE;
+
+    for (int i = 0; i < EXTENT_FANOUT; i++)
+        if (!subtree_prune(&node->slots[i], level - 1))
+            empty = FALSE;
+    if (empty) {
+        slab_free(node);
+        *slot = NULL;
+    }
+    return empty;
+}
+
+/*
+ * Initializes the block pool.
+ */
+void extent_pool_init() {
+    free_blocks = NULL;
+    blocks_used = 0;
+}
+
+/*
+ * Releases the block pool, the maps that still use it must not be used
+ * afterwards.
+ */
+void extent_pool_destroy() {
+    for (int i = 0; i < region_count; i++)
+        hugepage_release(regions[i], EXTENT_REGION_SIZE);
+    free(regions);
+    regions = NULL;
+    region_next = region_end = NULL;
+    region_count = region_max = 0;
+    free_blocks = NULL;
+    blocks_used = 0;
+}
+
+/*
+ * Copies part of the contents of a map, holes read as zeros.
+ * Input:
+ *  - map: the map
+ *  - buffer: receives the contents
+ *  - len: number of bytes to copy
+ *  - offset: where to start
+ */
+void extent_read(ExtentMap *map, char *buffer, long len, long offset) {
+    while (len > 0) {
+        unsigned long index = offset >> EXTENT_BLOCK_SHIFT;
+        long start = offset & (EXTENT_BLOCK_SIZE - 1);
+        long n = len < EXTENT_BLOCK_SIZE - start ? len : EXTENT_BLOCK_SIZE - start;
+        void **slot = index < map_capacity(map->levels) ? map_slot(map, index, FALSE) : NULL;
+        char *block = slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+
+        if (block)
+            memcpy(buffer, block + start, n);
+        else
+            memset(buffer, 0, n);
+        buffer += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+/*
+ * Checks if a map can index the blocks up to a size without adding levels.
+ * Returns: TRUE or FALSE
+ */
+int extent_covers(ExtentMap *map, long size) {
+    return size <= 0 || ((size - 1) >> EXTENT_BLOCK_SHIFT) < map_capacity(map->levels);
+}
+
+/*
+ * Writes part of the contents of a map, allocating the blocks it covers
+ * that were holes. Writes of disjoint ranges may run at the same time if
+ * the map covers both of them (see extent_covers): they only fill empty
+ * slots, and whoever fills one first wins.
+ * Input:
+ *  - map: the map
+ *  - buffer: data to write
+ *  - len: number of bytes to write
+ *  - offset: where to start
+ */
+void extent_write(ExtentMap *map, char *buffer, long len, long offset) {
+    if (len <= 0)
+        return;
+
+    map_grow(map, (offset + len - 1) >> EXTENT_BLOCK_SHIFT);
+
+    while (len > 0) {
+        long start = offset & (EXTENT_BLOCK_SIZE - 1);
+        long n = len < EXTENT_BLOCK_SIZE - start ? len : EXTENT_BLOCK_SIZE - start;
+        void **slot = map_slot(map, offset >> EXTENT_BLOCK_SHIFT, TRUE);
+        char *block = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+        if (!block) {
+            /* what the write doesn't cover is still a hole */
+            block = block_alloc();
+            memset(block, 0, start);
+            memset(block + start + n, 0, EXTENT_BLOCK_SIZE - start - n);
+            block = slot_install((void**)slot, block, 0);
+        }
+        memcpy(block + start, buffer, n);
+        buffer += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+/*
+ * Frees the blocks of a map past a size and zeroes the rest of the block
+ * the size ends in, so that growing the file again reads zeros there.
+ * Levels that are no longer needed are removed.
+ * Input:
+ *  - map: the map
+ *  - size: new size of the contents
+ */
+void extent_truncate(ExtentMap *map, long size) {
+    unsigned long keep = (size + EXTENT_BLOCK_SIZE - 1) >> EXTENT_BLOCK_SHIFT;
+
+    if (keep < map_capacity(map->levels))
+        subtree_free(&map->root, map->levels, keep);
+
+    if ((size & (EXTENT_BLOCK_SIZE - 1)) && keep <= map_capacity(map->levels)) {
+        long start = size & (EXTENT_BLOCK_SIZE - 1);
+        void **slot = map_slot(map, keep - 1, FALSE);
+
+        if (slot && *slot)
+            memset((char*)*slot + start, 0, EXTENT_BLOCK_SIZE - start);
+    }
+
+    while (map->levels > 0 && keep <= map_capacity(map->levels - 1)) {
+        ExtentNode *node = map->root;
+
+        map->root = node ? node->slots[0] : NULL;
+        slab_free(node);
+        map->levels--;
+    }
+}
+
+/*
+ * Moves part of the contents of one map into another, leaving holes
+ * behind. Blocks the destination doesn't have are handed over as they are,
+ * so only the bytes of blocks both maps have are copied. The levels of the
+ * source are kept, but nodes that no longer index a block are freed.
+ * The bytes of the destination from start on must be zeros, and so must
+ * the bytes of the source outside [start, end) in the blocks that hold it.
+ * Input:
+ *  - to: map that receives the contents
+ *  - from: map they are taken from
+ *  - start, end: bytes to move
+ */
+void extent_move(ExtentMap *to, ExtentMap *from, long start, long end) {
+    if (end <= start)
+        return;
+
+    map_grow(to, (end - 1) >> EXTENT_BLOCK_SHIFT);
+
+    for (unsigned long index = start >> EXTENT_BLOCK_SHIFT; index <= (end - 1) >> EXTENT_BLOCK_SHIFT; index++) {
+        void **from_slot = index < map_capacity(from->levels) ? map_slot(from, index, FALSE) : NULL;
+        char *block = from_slot ? *from_slot : NULL;
+
+        if (!block)
+            continue;
+        *from_slot = NULL;
+
+        void **to_slot = map_slot(to, index, TRUE);
+        long block_start = index << EXTENT_BLOCK_SHIFT;
+
+        if (!*to_slot)
+            *to_slot = block;
+        else {
+            long first = start > block_start ? start - block_start : 0;
+            long last = end < block_start + EXTENT_BLOCK_SIZE ? end - block_start : EXTENT_BLOCK_SIZE;
+
+            memcpy((char*)*to_slot + first, block + first, last - first);
+            block_free(block);
+        }
+    }
+    subtree_prune(&from->root, from->levels);
+}
+
+/*
+ * Prints the block pool statistics.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void extent_print_stats(FILE *fp) {
+    mutex_lock(&pool_lock);
+    fprintf(fp, "extent: %lu blocks of %d bytes in use, %lu free, %d regions\n",
+            blocks_used, EXTENT_BLOCK_SIZE,
+            region_count * (unsigned long)(EXTENT_REGION_SIZE / EXTENT_BLOCK_SIZE) - blocks_used, region_count);
+    mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,45 @@
+#ifndef EXTENT_H
+#define EXTENT_H
+
+#include <stdio.h>
+#include "hugepage.h"
+
+/*
+ * Contents of the files that don't fit in their i-node are kept in
+ * fixed-size blocks indexed like a page table: a file of one block points
+ * to it directly, larger ones through levels of EXTENT_FANOUT pointers that
+ * are added on top as the file grows. Writes only touch the blocks they
+ * cover, blocks never written are holes that read as zeros, and truncating
+ * frees the blocks past the new size without copying anything.
+ * Blocks come from a pool carved out of huge page regions (see hugepage.h)
+ * and are reused once freed, the index nodes are slab objects.
+ * Operations on the same map must be serialized by the caller (the i-node
+ * lock), except for reads and writes of disjoint ranges, see extent_write.
+ * Bytes past the end of a file are kept zeroed in its last block.
+ */
+#define EXTENT_BLOCK_SHIFT 12
+#define EXTENT_BLOCK_SIZE (1 << EXTENT_BLOCK_SHIFT)
+#define EXTENT_FANOUT_SHIFT 9
+#define EXTENT_FANOUT (1 << EXTENT_FANOUT_SHIFT)
+#define EXTENT_REGION_SIZE HUGEPAGE_SIZE
+
+typedef struct extentNode {
+	void *slots[EXTENT_FANOUT]; /* blocks at the lowest level, nodes above */
+} ExtentNode;
+
+typedef struct extentMap {
+	void *root; /* the only block while levels is 0, NULL if empty */
+	int levels; /* of nodes above the blocks */
+} ExtentMap;
+
+
+void extent_pool_init();
+void extent_pool_destroy();
+void extent_read(ExtentMap *map, char *buffer, long len, long offset);
+void extent_write(ExtentMap *map, char *buffer, long len, long offset);
+void extent_truncate(ExtentMap *map, long size);
+int extent_covers(ExtentMap *map, long size);
+void extent_move(ExtentMap *to, ExtentMap *from, long start, long end);
+void extent_print_stats(FILE *fp);
+
+#endif /* EXTENT_H */
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "state.h"
+#include "hugepage.h"
+
+static unsigned long hugetlb_regions = 0, thp_regions = 0, hugepage_bytes = 0;
+
+static size_t hugepage_round(size_t size) {
+    return (size + HUGEPAGE_SIZE - 1) & ~(size_t)(HUGEPAGE_SIZE - 1);
+}
+
+/*
+ * Maps normal pages aligned to HUGEPAGE_SIZE, so that the kernel can back
+ * them with transparent huge pages, and advises it to.
+ * Input:
+ *  - size: size of the region, a multiple of HUGEPAGE_SIZE
+ *  - flags: extra mmap flags
+ * Returns: pointer to the region, or NULL if it can't be mapped
+ */
+static void *thp_map(size_t size, int flags) {
+    /* one huge page more, then the ends are trimmed to the alignment */
+    char *ptr = mmap(NULL, size + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    char *aligned = (char*)(((uintptr_t)ptr + HUGEPAGE_SIZE - 1) & ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+
+    if (aligned > ptr)
+        munmap(ptr, aligned - ptr);
+    if (aligned < ptr + HUGEPAGE_SIZE)
+        munmap(aligned + size, ptr + HUGEPAGE_SIZE - aligned);
+
+#ifdef MADV_HUGEPAGE
+    /* only a hint, it fails on kernels without transparent huge pages */
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    __atomic_add_fetch(&thp_regions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hugepage_bytes, size, __ATOMIC_RELAXED);
+    return aligned;
+}
+
+/*
+ * Allocates a region that is used right away, zero filled.
+ * Input:
+ *  - size: size of the region, rounded up to HUGEPAGE_SIZE
+ * Returns: pointer to the region, aligned to HUGEPAGE_SIZE
+ */
+void *hugepage_alloc(size_t size) {
+    size = hugepage_round(size);
+
+#ifdef MAP_HUGETLB
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (ptr != MAP_FAILED) {
+        __atomic_add_fetch(&hugetlb_regions, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&hugepage_bytes, size, __ATOMIC_RELAXED);
+        return ptr;
+    }
+#endif
+
+    void *region = thp_map(size, 0);
+
+    if (!region) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return region;
+}
+
+/*
+ * Reserves address space for a table sized for its maximum capacity. Its
+ * pages only take memory once they are touched, so the hugetlbfs pool,
+ * which is taken up front, is never used for it.
+ * Input:
+ *  - size: size of the region, rounded up to HUGEPAGE_SIZE
+ * Returns: pointer to the zero filled region, aligned to HUGEPAGE_SIZE, or
+ *  NULL if the address space can't be reserved
+ */
+void *hugepage_reserve(size_t size) {
+    return thp_map(hugepage_round(size), MAP_NORESERVE);
+}
+
+/*
+ * Releases a region returned by hugepage_alloc or hugepage_reserve.
+ * Input:
+ *  - ptr: pointer to the region
+ *  - size: size it was allocated with
+ */
+void hugepage_release(void *ptr, size_t size) {
+    size = hugepage_round(size);
+    if (munmap(ptr, size) != 0) {
+        fprintf(stderr, "Error: failed to unmap memory\n");
+        exit(EXIT_FAILURE);
+    }
+    __atomic_sub_fetch(&hugepage_bytes, size, __ATOMIC_RELAXED);
+}
+
+/*
+ * Prints the huge page statistics.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void hugepage_print_stats(FILE *fp) {
+    fprintf(fp, "hugepage: %lu regions from the hugetlb pool, %lu advised for transparent huge pages, %lu MB of address space\n",
+            __atomic_load_n(&hugetlb_regions, __ATOMIC_RELAXED), __atomic_load_n(&thp_regions, __ATOMIC_RELAXED),
+            __atomic_load_n(&hugepage_bytes, __ATOMIC_RELAXED) / (1024 * 1024));
+}
@@ -0,0 +1,23 @@
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* size of the huge pages regions are aligned to and rounded up to */
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * Large regions of memory backed by huge pages when the system has them,
+ * so that the i-node table and the slab chunks take few TLB entries.
+ * Regions come from the hugetlbfs pool (MAP_HUGETLB) when it has enough
+ * free pages, and otherwise from normal pages advised for transparent huge
+ * pages (MADV_HUGEPAGE), which the kernel may or may not honour.
+ */
+
+void *hugepage_alloc(size_t size);
+void *hugepage_reserve(size_t size);
+void hugepage_release(void *ptr, size_t size);
+void hugepage_print_stats(FILE *fp);
+
+#endif /* HUGEPAGE_H */
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "state.h"
+#include "stats.h"
+#include "arena.h"
+#include "lockset.h"
+
+/*
+ * Initializes an empty lock set.
+ * Input:
+ *  - set: the lock set, usually a local variable of the operation
+ */
+void lockset_init(LockSet *set) {
+    set->count = 0;
+    set->size = LOCKSET_INLINE;
+    set->entries = set->inline_entries;
+}
+
+static int lockset_find(LockSet *set, int inumber) {
+    for (int i = 0; i < set->count; i++)
+        if (set->entries[i].inumber == inumber)
+            return i;
+    return FAIL;
+}
+
+/*
+ * Checks if the set holds the lock of an i-node.
+ * Returns: TRUE or FALSE
+ */
+int lockset_holds(LockSet *set, int inumber) {
+    return lockset_find(set, inumber) != FAIL;
+}
+
+/*
+ * Adds an i-node that is already locked to the set.
+ * Used for i-nodes locked elsewhere, like the ones returned by inode_create,
+ * that no other thread can be waiting for.
+ * Input:
+ *  - set: the lock set
+ *  - inumber: identifier of the i-node
+ *  - write: TRUE if it is write locked
+ */
+void lockset_add(LockSet *set, int inumber, int write) {
+    if (set->count == set->size) {
+        /* the old entries are released with the rest in lockset_release */
+        if (set->entries == set->inline_entries)
+            set->mark = arena_mark();
+
+        LockEntry *entries = arena_alloc(2 * set->size * sizeof(LockEntry));
+
+        memcpy(entries, set->entries, set->count * sizeof(LockEntry));
+        set->entries = entries;
+        set->size *= 2;
+    }
+    set->entries[set->count].inumber = inumber;
+    set->entries[set->count++].write = write;
+}
+
+/*
+ * Locks an i-node and adds it to the set. If its inumber is above every
+ * inumber in the set it waits for the lock, otherwise it only tries it.
+ * An i-node already in the set is not locked again; a read lock can't be
+ * upgraded, callers lock such i-nodes for writing first.
+ * Input:
+ *  - set: the lock set
+ *  - inumber: identifier of the i-node
+ *  - write: TRUE for a write lock, FALSE for a read lock
+ * Returns:
+ *  - SUCCESS: if the set holds the lock
+ *  - RETRY: if the lock was busy, the caller must release the set and
+ *           start again (see lockset_backoff)
+ *  - ABORT: if locking failed
+ */
+int lockset_lock(LockSet *set, int inumber, int write) {
+    int in_order = TRUE, i = lockset_find(set, inumber);
+
+    if (i != FAIL) {
+        if (write && !set->entries[i].write) {
+            fprintf(stderr, "Error: can't upgrade the lock of i-node %d\n", inumber);
+            return ABORT;
+        }
+        return SUCCESS;
+    }
+
+    for (i = 0; i < set->count && in_order; i++)
+        in_order = set->entries[i].inumber < inumber;
+
+    if (in_order) {
+        if ((write ? inode_wrlock(inumber) : inode_rdlock(inumber)) != SUCCESS)
+            return ABORT;
+    }
+    else {
+        stats_add(STAT_LOCKSET_TRY, 1);
+        if ((write ? inode_trywrlock(inumber) : inode_tryrdlock(inumber)) != SUCCESS) {
+            stats_add(STAT_LOCKSET_BACKOFF, 1);
+            return RETRY;
+        }
+    }
+
+    lockset_add(set, inumber, write);
+    return SUCCESS;
+}
+
+/*
+ * Unlocks one i-node of the set and removes it from the set.
+ * Returns: SUCCESS, FAIL if the set doesn't hold it or ABORT
+ */
+int lockset_unlock(LockSet *set, int inumber) {
+    int i = lockset_find(set, inumber);
+
+    if (i == FAIL)
+        return FAIL;
+    set->entries[i] = set->entries[--set->count];
+    return inode_unlock(inumber) == SUCCESS ? SUCCESS : ABORT;
+}
+
+/*
+ * Unlocks every i-node in the set, leaving it empty.
+ * Returns: SUCCESS or ABORT
+ */
+int lockset_release(LockSet *set) {
+    int res = SUCCESS;
+
+    while (set->count > 0)
+        if (inode_unlock(set->entries[--set->count].inumber) != SUCCESS)
+            res = ABORT;
+
+    if (set->entries != set->inline_entries)
+        arena_release(set->mark);
+    lockset_init(set);
+    return res;
+}
+
+/*
+ * Waits before an operation that got RETRY starts again: the first
+ * attempts only yield, the next ones sleep exponentially longer.
+ * Input:
+ *  - attempt: how many times the operation was already retried
+ */
+void lockset_backoff(int attempt) {
+    if (attempt < LOCKSET_YIELDS) {
+        sched_yield();
+        return;
+    }
+
+    long us = 1L << (attempt - LOCKSET_YIELDS < 10 ? attempt - LOCKSET_YIELDS : 10);
+    struct timespec delay;
+
+    if (us > LOCKSET_MAX_SLEEP_US)
+        us = LOCKSET_MAX_SLEEP_US;
+    delay.tv_sec = 0;
+    delay.tv_nsec = us * 1000;
+    nanosleep(&delay, NULL);
+}
@@ -0,0 +1,47 @@
+#ifndef LOCKSET_H
+#define LOCKSET_H
+
+#include "arena.h"
+
+/* returned by operations that must be retried */
+#define RETRY -3
+
+/* locks kept inside the set itself, more than these are moved to the arena */
+#define LOCKSET_INLINE 16
+
+/* back-offs that only yield the CPU before sleeping, and the longest sleep */
+#define LOCKSET_YIELDS 4
+#define LOCKSET_MAX_SLEEP_US 1000
+
+/*
+ * Set of i-node locks held by one operation, declared on its stack.
+ * Locks are acquired in increasing inumber order. A lock that would break
+ * the order is only tried, and if it is busy the operation releases the
+ * whole set and starts again, so threads never wait for each other in a
+ * cycle, whatever paths they lock. Sets that outgrow their inline entries
+ * take them from the thread's arena, so a thread's sets must be released
+ * in the reverse order they were initialized, as their stack frames are.
+ */
+typedef struct lockEntry {
+	int inumber;
+	int write;
+} LockEntry;
+
+typedef struct lockSet {
+	int count;
+	int size;
+	LockEntry *entries;
+	LockEntry inline_entries[LOCKSET_INLINE];
+	ArenaMark mark; /* arena position before the set grew, see lockset_add */
+} LockSet;
+
+
+void lockset_init(LockSet *set);
+int lockset_holds(LockSet *set, int inumber);
+int lockset_lock(LockSet *set, int inumber, int write);
+void lockset_add(LockSet *set, int inumber, int write);
+int lockset_unlock(LockSet *set, int inumber);
+int lockset_release(LockSet *set);
+void lockset_backoff(int attempt);
+
+#endif /* LOCKSET_H */
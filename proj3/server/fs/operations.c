@@ -1,10 +1,23 @@
 #include "operations.h"
+#include "session.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include <pthread.h>
 
-extern inode_t inode_table[INODE_TABLE_SIZE];
+static int lookup_from(int start, char *name, LockSet *set, int flag);
+static void file_compact(int inumber);
+
+/* lookups try the dentry cache and lock-free walks first (SYNC_OPTIMISTIC) */
+static int optimistic_reads = TRUE;
+/* lookup_aux releases each ancestor as soon as the next one is locked */
+static int lock_coupling = TRUE;
+/* file writes only read lock the i-node and lock their byte range */
+static int range_locking = TRUE;
+/* appends only read lock the i-node, see file_append */
+static int shared_appends = TRUE;
 
 /* Given a path, fills pointers with strings for the parent path and child
  * file name
@@ -43,21 +56,113 @@ void split_parent_child_from_path(char * path, char ** parent, char ** child) {
 }
 
 
+/*
+ * Splits two paths at their longest common ancestor, comparing whole
+ * components: the common ancestor of "/a/b/c" and "a/b/d" is "/a/b", but
+ * the one of "/a/b" and "/a/bc" is "/a".
+ * Input:
+ *  - a, b: the paths
+ *  - ancestor: buffer for the common ancestor, as long as a or b
+ *  - a_rest, b_rest: references to store the parts of a and b below it
+ * Returns: number of components of the common ancestor
+ */
+int split_common_ancestor(char *a, char *b, char *ancestor, char **a_rest, char **b_rest) {
+	int components = 0, len = 0;
+
+	while (TRUE) {
+		while (*a == '/')
+			a++;
+		while (*b == '/')
+			b++;
+
+		int a_len = strcspn(a, "/"), b_len = strcspn(b, "/");
+
+		if (a_len == 0 || a_len != b_len || strncmp(a, b, a_len) != 0)
+			break;
+		ancestor[len++] = '/';
+		memcpy(ancestor + len, a, a_len);
+		len += a_len;
+		a += a_len;
+		b += b_len;
+		components++;
+	}
+
+	ancestor[len] = '\0';
+	*a_rest = a;
+	*b_rest = b;
+	return components;
+}
+
+
+/*
+ * Copies a path to the arena of the calling thread (see arena.h), sized
+ * from its length, for strtok_r to split. The copies are released by the
+ * operation once it returns, as the lock set may take arena memory after
+ * them (see lockset_add).
+ */
+static char *path_copy(char *path) {
+	return strcpy(arena_alloc(strlen(path) + 1), path);
+}
+
+/*
+ * Chooses how create, delete and move lock their paths. With lock coupling
+ * only the directories being changed stay locked; otherwise every ancestor
+ * stays read locked until the operation ends. Must be set before any
+ * operation runs.
+ * Input:
+ *  - enabled: TRUE or FALSE
+ */
+void set_lock_coupling(int enabled) {
+	lock_coupling = enabled;
+}
+
+/*
+ * Chooses whether writes to disjoint ranges of a file run in parallel
+ * (see file_write), or every write locks the whole file.
+ * Input:
+ *  - enabled: TRUE or FALSE
+ */
+void set_range_locking(int enabled) {
+	range_locking = enabled;
+}
+
+/*
+ * Chooses whether appends to a file run in parallel (see file_append), or
+ * every append locks the whole file.
+ * Input:
+ *  - enabled: TRUE or FALSE
+ */
+void set_shared_appends(int enabled) {
+	shared_appends = enabled;
+}
+
+
 /*
  * Initializes tecnicofs and creates root node.
  */
 void init_fs() {
+	slab_init();
+	extent_pool_init();
+	sync_init();
+	optimistic_reads = sync_get_strategy() == SYNC_OPTIMISTIC;
+	reclaim_init();
 	inode_table_init();
+	dcache_init();
+	session_init();
+	compactor_init(file_compact);
 	
 	/* create root inode */
 	int root = inode_create(T_DIRECTORY);
-	if (pthread_rwlock_unlock(&inode_table[root].rwlock) != 0)
+	if (inode_unlock(root) != SUCCESS)
 		fprintf(stderr, "Error: failed to unlock root\n");
 	
 	if (root != FS_ROOT) {
 		printf("failed to create node for tecnicofs root\n");
 		exit(EXIT_FAILURE);
 	}
+
+	/* every operation read locks the root */
+	inode_use_brlock(FS_ROOT);
 }
 
 
@@ -65,29 +170,31 @@ void init_fs() {
  * Destroy tecnicofs and inode table.
  */
 void destroy_fs() {
+	compactor_destroy();
+	session_destroy();
+	dcache_destroy();
+	/* runs the pending callbacks while the i-node table still exists */
+	reclaim_destroy();
 	inode_table_destroy();
+	sync_destroy();
+	extent_pool_destroy();
+	slab_destroy();
 }
 
 
 /*
  * Checks if content of directory is not empty.
  * Input:
- *  - entries: entries of directory
+ *  - dir: directory
  * Returns: SUCCESS or FAIL
  */
 
-int is_dir_empty(DirEntry *dirEntries) {
-	if (dirEntries == NULL) {
+int is_dir_empty(Directory *dir) {
+	if (dir == NULL) {
 		return FAIL;
 	}
-	  
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-		if (dirEntries[i].inumber != FREE_INODE) {
-			return FAIL;
-		}
-	}
-	   
-	return SUCCESS;
+
+	return directory_count(dir) == 0 ? SUCCESS : FAIL;
 }
 
 
@@ -95,23 +202,17 @@ int is_dir_empty(DirEntry *dirEntries) {
  * Looks for node in directory entry from name.
  * Input:
  *  - name: path of node
- *  - entries: entries of directory
+ *  - dir: directory
  * Returns:
  *  - inumber: found node's inumber
  *  - FAIL: if not found
  */
-int lookup_sub_node(char *name, DirEntry *entries) {
-	if (entries == NULL) {
+int lookup_sub_node(char *name, Directory *dir) {
+	if (dir == NULL) {
 		return FAIL;
 	}
 
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (entries[i].inumber != FREE_INODE && strcmp(entries[i].name, name) == 0) {
-			return entries[i].inumber;
-        }
-    }
-
-	return FAIL;
+	return directory_lookup(dir, name);
 }
 
 
@@ -120,26 +221,31 @@ int lookup_sub_node(char *name, DirEntry *entries) {
  * Input:
  *  - name: path of node
  *  - nodeType: type of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS, FAIL or RETRY if it must be tried again
  */
-int create(char *name, type nodeType){
+static int create_aux(char *name, type nodeType){
 
 	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
-	Stack stack = STACKinit(STACK_SIZE);
+	char *parent_name, *child_name, *name_copy = path_copy(name);
+	LockSet set;
+	unsigned long gen = dcache_gen(name);
 	/* use for copy */
 	type pType;
 	union Data pdata;
 
-	strcpy(name_copy, name);
+	lockset_init(&set);
 	split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
-	parent_inumber = lookup_aux(parent_name, stack, CREATE);
+	parent_inumber = lookup_aux(parent_name, &set, CREATE);
 
+	if (parent_inumber == ABORT || parent_inumber == RETRY) {
+		unlock(&set);
+		return parent_inumber;
+	}
 	if (parent_inumber == FAIL) {
 		printf("failed to create %s, invalid parent dir %s\n",
 		        name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
@@ -148,14 +254,14 @@ int create(char *name, type nodeType){
 	if(pType != T_DIRECTORY) {
 		printf("failed to create %s, parent %s is not a dir\n",
 		        name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
-	if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL) {
+	if (lookup_sub_node(child_name, pdata.dir) != FAIL) {
 		printf("failed to create %s, already exists in dir %s\n",
 		       child_name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
@@ -164,49 +270,78 @@ int create(char *name, type nodeType){
 	child_inumber = inode_create(nodeType);
 	
 	if (child_inumber > 0)
-		STACKpush(stack, child_inumber);
+		lockset_add(&set, child_inumber, TRUE);
 	else {
 		printf("failed to create %s in %s, couldn't allocate inode\n",
 		        child_name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
+	/* the parent is only read locked, another create may have added the name meanwhile */
 	if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL) {
 		printf("could not add entry %s in dir %s\n",
 		       child_name, parent_name);
-		if (unlock(stack)) return ABORT;
+		inode_delete(child_inumber);
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
-	if (unlock(stack)) return ABORT;
+	if (optimistic_reads)
+		dcache_insert(name, child_inumber, gen);
+
+	if (unlock(&set)) return ABORT;
 	return SUCCESS;
 }
 
+/*
+ * Creates a new node given a path, see create_aux.
+ * Returns: SUCCESS or FAIL
+ */
+int create(char *name, type nodeType) {
+	int res, attempt = 0;
+	ArenaMark mark = arena_mark();
+
+	sync_lock(TRUE);
+	while ((res = create_aux(name, nodeType)) == RETRY) {
+		arena_release(mark);
+		lockset_backoff(attempt++);
+	}
+	sync_unlock();
+	arena_release(mark);
+	return res;
+}
+
 
 /*
  * Deletes a node given a path.
  * Input:
  *  - name: path of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS, FAIL or RETRY if it must be tried again
  */
-int delete(char *name){
+static int delete_aux(char *name){
 
-	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
-	Stack stack = STACKinit(STACK_SIZE);
+	int parent_inumber, child_inumber, res;
+	char *parent_name, *child_name, *name_copy = path_copy(name);
+	LockSet set;
 	/* use for copy */
 	type pType, cType;
 	union Data pdata, cdata;
 
-	strcpy(name_copy, name);
+	unsigned long moves = optimistic_reads ? dcache_moves(name) : 0;
+
+	lockset_init(&set);
 	split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
-	parent_inumber = lookup_aux(parent_name, stack, DELETE);
+	parent_inumber = lookup_aux(parent_name, &set, DELETE);
 
+	if (parent_inumber == ABORT || parent_inumber == RETRY) {
+		unlock(&set);
+		return parent_inumber;
+	}
 	if (parent_inumber == FAIL) {
 		printf("failed to delete %s, invalid parent dir %s\n",
 		        child_name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
@@ -215,157 +350,575 @@ int delete(char *name){
 	if(pType != T_DIRECTORY) {
 		printf("failed to delete %s, parent %s is not a dir\n",
 		        child_name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
-	child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
+	child_inumber = lookup_sub_node(child_name, pdata.dir);
 
-	if (child_inumber != FAIL) {
-		wrlock(child_inumber);
-		STACKpush(stack, child_inumber);
+	if (child_inumber != FAIL && (res = lockset_lock(&set, child_inumber, TRUE)) != SUCCESS) {
+		unlock(&set);
+		return res;
 	}
-	else {
+
+	/* another delete of the same name may have won the race for the lock */
+	if (child_inumber == FAIL || directory_lookup_again(pdata.dir, child_name) != child_inumber) {
 		printf("could not delete %s, does not exist in dir %s\n",
 		       name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
 	inode_get(child_inumber, &cType, &cdata);
 
-	if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
+	/* opens read lock the file, so none can start while it is write locked */
+	if (cType == T_FILE && inode_open_count(child_inumber) > 0) {
+		printf("could not delete %s: file is open\n", name);
+		if (unlock(&set)) return ABORT;
+		return TECNICOFS_ERROR_FILE_IS_OPEN;
+	}
+
+	if (cType == T_DIRECTORY && is_dir_empty(cdata.dir) == FAIL) {
 		printf("could not delete %s: is a directory and not empty\n",
 		       name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
 
 	/* remove entry from folder that contained deleted node */
 
-	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
+	if (dir_reset_entry(parent_inumber, child_inumber, child_name) == FAIL) {
 		printf("failed to delete %s from dir %s\n",
 		       child_name, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
+	/* a deleted directory is empty, so only its own entry can be cached */
+	if (optimistic_reads)
+		dcache_invalidate(name);
+	/* unless a move renamed an ancestor after it was unlocked, then the
+	 * node may also be cached under its new path, which isn't known here */
+	if (optimistic_reads && lock_coupling && dcache_moves(name) != moves)
+		dcache_invalidate_subtree("");
 
 	if (inode_delete(child_inumber) == FAIL) {
 		printf("could not delete inode number %d from dir %s\n",
 		       child_inumber, parent_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		return FAIL;
 	}
-	if (unlock(stack)) return ABORT;
+	if (unlock(&set)) return ABORT;
 	return SUCCESS;
 }
 
 /*
- * Lookup for a given path.
+ * Deletes a node given a path, see delete_aux.
+ * Returns: SUCCESS or FAIL
+ */
+int delete(char *name) {
+	int res, attempt = 0;
+	ArenaMark mark = arena_mark();
+
+	sync_lock(TRUE);
+	while ((res = delete_aux(name)) == RETRY) {
+		arena_release(mark);
+		lockset_backoff(attempt++);
+	}
+	sync_unlock();
+	arena_release(mark);
+	return res;
+}
+
+/*
+ * Lookup for a given path that takes no locks. The versions of the
+ * directories read along the path are validated at the end, so the result
+ * is only returned if none of them was write locked meanwhile.
  * Input:
  *  - name: path of node
  * Returns:
  *  inumber: identifier of the i-node, if found
- *     FAIL: otherwise
+ *     FAIL: if not found
+ *    RETRY: if a concurrent writer was detected
  */
-int lookup(char *name) {
-	char full_path[MAX_FILE_NAME];
+int lookup_optimistic(char *name) {
+	ArenaMark mark = arena_mark();
+	char *full_path = path_copy(name);
 	char delim[] = "/";
 	char *saveptr;
-	Stack stack = STACKinit(STACK_SIZE);
+	int inumbers[MAX_PATH_DEPTH], depth = 0, dirs_read = 0, res;
+	unsigned int versions[MAX_PATH_DEPTH];
+	unsigned long dir_versions[MAX_PATH_DEPTH];
+	Directory *dirs[MAX_PATH_DEPTH];
+	char *names[MAX_PATH_DEPTH];
+	DirProbe probes[MAX_PATH_DEPTH];
+	type nType;
+	union Data data;
 
-	strcpy(full_path, name);
+	reclaim_enter();
 
-	/* start at root node */
 	int current_inumber = FS_ROOT;
+	char *path = strtok_r(full_path, delim, &saveptr);
 
-	/* use for copy */
-	type nType;
-	union Data data;
+	while (TRUE) {
+		unsigned int version = inode_read_begin(current_inumber);
 
-	/* get root inode data */
-	inode_get(current_inumber, &nType, &data);
+		if ((version & 1) || depth == MAX_PATH_DEPTH) {
+			res = RETRY;
+			break;
+		}
+		inumbers[depth] = current_inumber;
+		versions[depth++] = version;
 
-	char *path = strtok_r(full_path, delim, &saveptr);
+		if (path == NULL) {
+			res = current_inumber;
+			break;
+		}
 
-	if (rdlock(current_inumber)) {
-			if (unlock(stack)) return ABORT;
-			return ABORT;
+		if (inode_peek(current_inumber, &nType, &data) == FAIL || nType != T_DIRECTORY) {
+			res = FAIL;
+			break;
 		}
-	else
-		STACKpush(stack, current_inumber);
 
-	/* search for all sub nodes */
-	while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
-		inode_get(current_inumber, &nType, &data);
-		if (rdlock(current_inumber)) {
-			if (unlock(stack)) return ABORT;
-			return ABORT;
+		/* creates and deletes only change the stripe of the name, not the version of the i-node */
+		unsigned long dir_version = directory_read_begin(data.dir, path);
+		if (dir_version & 1) {
+			res = RETRY;
+			break;
+		}
+		dirs[dirs_read] = data.dir;
+		names[dirs_read] = path;
+		dir_versions[dirs_read++] = dir_version;
+
+		if ((current_inumber = directory_peek(data.dir, path, &probes[dirs_read - 1])) == FAIL) {
+			res = FAIL;
+			break;
 		}
-		else
-			STACKpush(stack, current_inumber);
 		path = strtok_r(NULL, delim, &saveptr);
 	}
 
-	if (unlock(stack)) return ABORT;
+	for (int i = 0; res != RETRY && i < depth; i++)
+		if (!inode_read_validate(inumbers[i], versions[i]))
+			res = RETRY;
+	for (int i = 0; res != RETRY && i < dirs_read; i++)
+		if (!directory_read_validate(dirs[i], names[i], dir_versions[i]))
+			res = RETRY;
+
+	reclaim_exit();
+
+	/* a retried walk is counted by the lookup that replaces it */
+	for (int i = 0; res != RETRY && i < dirs_read; i++)
+		directory_count_probe(probes[i]);
+	stats_add(res == RETRY ? STAT_OPTIMISTIC_RETRY : STAT_OPTIMISTIC_LOOKUP, 1);
+	arena_release(mark);
+	return res;
+}
+
+/*
+ * Lookup for a given path that read locks it, see lookup_aux.
+ * Input:
+ *  - name: path of node
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+static int lookup_locked(char *name) {
+	LockSet set;
+	int res, attempt = 0;
+	ArenaMark mark = arena_mark();
+
+	lockset_init(&set);
+	while ((res = lookup_aux(name, &set, LOOKUP)) == RETRY) {
+		unlock(&set);
+		arena_release(mark);
+		lockset_backoff(attempt++);
+	}
+
+	if (unlock(&set)) res = ABORT;
+	arena_release(mark);
 
-	return current_inumber;
+	return res;
 }
 
 /*
- * Lookup that write locks the last inode from the path
+ * Lookup for a given path.
+ * With SYNC_OPTIMISTIC it tries the dentry cache, then an optimistic walk
+ * and only falls back to the locked walk if a concurrent writer is
+ * detected. The other strategies always lock the path.
  * Input:
  *  - name: path of node
- *  - stack: stack to store locks
- *  - flag: delete/create = 0, move = 1
  * Returns:
  *  inumber: identifier of the i-node, if found
  *     FAIL: otherwise
  */
-int lookup_aux(char *name, Stack stack, int flag) {
-	char full_path[MAX_FILE_NAME];
+int lookup(char *name) {
+	int res;
+
+	if (!optimistic_reads) {
+		sync_lock(FALSE);
+		res = lookup_locked(name);
+		sync_unlock();
+		return res;
+	}
+
+	if ((res = dcache_lookup(name)) != FAIL)
+		return res;
+
+	unsigned long gen = dcache_gen(name);
+
+	for (int try = 0; try < OPTIMISTIC_TRIES; try++)
+		if ((res = lookup_optimistic(name)) != RETRY)
+			break;
+	if (res == RETRY)
+		res = lookup_locked(name);
+
+	/* if a move changed the path meanwhile gen changed too, see dcache_insert */
+	if (res >= 0)
+		dcache_insert(name, res, gen);
+
+	return res;
+}
+
+/*
+ * Opens a file: the path is walked once, read locking it like a lookup,
+ * and the file can't be deleted until it is closed (see file_close).
+ * Input:
+ *  - name: path of the file
+ * Returns:
+ *  inumber: identifier of the file's i-node
+ *  TECNICOFS_ERROR_FILE_NOT_FOUND, TECNICOFS_ERROR_OTHER if it is not a
+ *  file, or ABORT
+ */
+int file_open(char *name) {
+	LockSet set;
+	int inumber, res, attempt = 0;
+	type nType;
+	ArenaMark mark = arena_mark();
+
+	sync_lock(FALSE);
+	lockset_init(&set);
+	while ((inumber = lookup_aux(name, &set, LOOKUP)) == RETRY) {
+		unlock(&set);
+		arena_release(mark);
+		lockset_backoff(attempt++);
+	}
+
+	if (inumber == FAIL)
+		res = TECNICOFS_ERROR_FILE_NOT_FOUND;
+	else if (inumber < 0)
+		res = inumber;
+	else {
+		inode_get(inumber, &nType, NULL);
+		res = nType == T_FILE && inode_open(inumber) == SUCCESS ? inumber : TECNICOFS_ERROR_OTHER;
+	}
+
+	if (unlock(&set)) res = ABORT;
+	sync_unlock();
+	arena_release(mark);
+	return res;
+}
+
+/*
+ * Locks an open file for a read or a write, taking the global lock of the
+ * synchronization strategy too.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ *  - write: TRUE to have the file to itself, FALSE to share it with the
+ *    holders of other byte ranges
+ * Returns: SUCCESS or ABORT
+ */
+static int file_lock(int inumber, int write) {
+	sync_lock(write);
+	if ((write ? inode_wrlock(inumber) : inode_rdlock(inumber)) != SUCCESS) {
+		sync_unlock();
+		return ABORT;
+	}
+	return SUCCESS;
+}
+
+static int file_unlock(int inumber) {
+	int res = inode_unlock(inumber);
+
+	sync_unlock();
+	return res == SUCCESS ? SUCCESS : ABORT;
+}
+
+/*
+ * Closes a file opened with file_open. The i-node is write locked, so that
+ * the last close can't drop the snapshot of a file_map in progress.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ * Returns: SUCCESS or ABORT
+ */
+int file_close(int inumber) {
+	if (file_lock(inumber, TRUE) != SUCCESS)
+		return ABORT;
+	inode_close(inumber);
+	return file_unlock(inumber);
+}
+
+/*
+ * Reads from an open file. Only the bytes read are locked, as a range of
+ * the file's byte-range lock, and the file's i-node is read locked; its
+ * path is not walked again.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ *  - buffer: receives the data
+ *  - len: maximum number of bytes to read
+ *  - offset: where to start in the file
+ * Returns: the number of bytes read, TECNICOFS_ERROR_OTHER or ABORT
+ */
+int file_read(int inumber, char *buffer, int len, long offset) {
+	RangeLock *ranges = inode_ranges(inumber);
+	Range range;
+	int res;
+
+	rangelock_lock(ranges, &range, offset, offset + len, FALSE);
+	if ((res = file_lock(inumber, FALSE)) == SUCCESS) {
+		if ((res = inode_read_file(inumber, buffer, len, offset)) == FAIL)
+			res = TECNICOFS_ERROR_OTHER;
+		if (file_unlock(inumber) != SUCCESS)
+			res = ABORT;
+	}
+	rangelock_unlock(ranges, &range);
+	return res;
+}
+
+/*
+ * Writes to an open file. The bytes written are write locked as a range,
+ * and writes within the blocks the file can already index only read lock
+ * its i-node, so writers of disjoint ranges run in parallel. Writes that
+ * change how the contents are stored write lock the i-node instead, and so
+ * do all of them without range locking (see set_range_locking).
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ *  - buffer: data to write
+ *  - len: number of bytes to write
+ *  - offset: where to start in the file
+ * Returns: the number of bytes written, TECNICOFS_ERROR_OTHER or ABORT
+ */
+int file_write(int inumber, char *buffer, int len, long offset) {
+	RangeLock *ranges = inode_ranges(inumber);
+	Range range;
+	int res = RETRY;
+
+	rangelock_lock(ranges, &range, offset, offset + len, TRUE);
+	if (range_locking && (res = file_lock(inumber, FALSE)) == SUCCESS) {
+		res = inode_write_file_shared(inumber, buffer, len, offset);
+		if (file_unlock(inumber) != SUCCESS)
+			res = ABORT;
+	}
+	/* the range stays locked, so the data can't change in between */
+	if (res == RETRY && (res = file_lock(inumber, TRUE)) == SUCCESS) {
+		res = inode_write_file(inumber, buffer, len, offset);
+		if (file_unlock(inumber) != SUCCESS)
+			res = ABORT;
+	}
+	if (res == FAIL)
+		res = TECNICOFS_ERROR_OTHER;
+	rangelock_unlock(ranges, &range);
+	return res;
+}
+
+/*
+ * Appends to an open file, at its size when the append takes place. Only
+ * the first append write locks the i-node, to add the file's log; the
+ * others read lock it, take their offset with a fetch-and-add on the end
+ * of the log and copy their data there, so concurrent appenders don't
+ * exclude each other (see applog.h). set_shared_appends(FALSE) has every
+ * append write lock the i-node instead.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ *  - buffer: data to append
+ *  - len: number of bytes to append
+ *  - offset: receives where the data was appended
+ * Returns: the number of bytes written, TECNICOFS_ERROR_OTHER or ABORT
+ */
+int file_append(int inumber, char *buffer, int len, long *offset) {
+	int res = RETRY, compact = FALSE;
+
+	if (shared_appends && (res = file_lock(inumber, FALSE)) == SUCCESS) {
+		res = inode_append_file(inumber, buffer, len, offset, &compact);
+		if (file_unlock(inumber) != SUCCESS)
+			res = ABORT;
+	}
+	if (res == RETRY && (res = file_lock(inumber, TRUE)) == SUCCESS) {
+		if ((res = inode_start_log(inumber)) == SUCCESS)
+			res = inode_append_file(inumber, buffer, len, offset, &compact);
+		if (file_unlock(inumber) != SUCCESS)
+			res = ABORT;
+	}
+
+	if (compact)
+		compactor_queue(inumber);
+	if (res == FAIL)
+		res = TECNICOFS_ERROR_OTHER;
+	return res;
+}
+
+/*
+ * Folds the log of a file into its extents, run by the compactor thread.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ */
+static void file_compact(int inumber) {
+	if (file_lock(inumber, TRUE) != SUCCESS) {
+		fprintf(stderr, "Error: failed to lock file to compact\n");
+		return;
+	}
+	inode_compact_file(inumber);
+	if (file_unlock(inumber) != SUCCESS)
+		fprintf(stderr, "Error: failed to unlock compacted file\n");
+}
+
+/*
+ * Gets the contents of an open file as a sealed, read-only memfd (see
+ * snapshot.h), to be passed to a client on the same host instead of
+ * copying them through the socket. Every range of the file is read locked,
+ * so the copy is consistent and writers wait for it, but readers don't.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ *  - fd: receives the descriptor of the snapshot, to be closed by the
+ *    caller
+ * Returns: the size of the file, TECNICOFS_ERROR_OTHER or ABORT
+ */
+int file_map(int inumber, int *fd) {
+	RangeLock *ranges = inode_ranges(inumber);
+	Range range;
+	int res;
+
+	*fd = -1;
+	rangelock_lock(ranges, &range, 0, LONG_MAX, FALSE);
+	if ((res = file_lock(inumber, FALSE)) == SUCCESS) {
+		if ((res = inode_map_file(inumber, fd)) == FAIL)
+			res = TECNICOFS_ERROR_OTHER;
+		if (file_unlock(inumber) != SUCCESS)
+			res = ABORT;
+	}
+	rangelock_unlock(ranges, &range);
+
+	if (res < 0 && *fd >= 0) {
+		close(*fd);
+		*fd = -1;
+	}
+	return res;
+}
+
+/*
+ * Changes the size of an open file, write locking only its i-node.
+ * Input:
+ *  - inumber: identifier of the file's i-node
+ *  - size: new size, see inode_truncate_file
+ * Returns: SUCCESS, TECNICOFS_ERROR_OTHER or ABORT
+ */
+int file_truncate(int inumber, long size) {
+	int res;
+
+	sync_lock(TRUE);
+	if (inode_wrlock(inumber) != SUCCESS) {
+		sync_unlock();
+		return ABORT;
+	}
+	if ((res = inode_truncate_file(inumber, size)) == FAIL)
+		res = TECNICOFS_ERROR_OTHER;
+	if (inode_unlock(inumber) != SUCCESS)
+		res = ABORT;
+	sync_unlock();
+	return res;
+}
+
+/*
+ * Lookup that locks the last inode from the path: write locked for a move,
+ * read locked otherwise, as create and delete only lock the stripe of the
+ * name they change (see directory.h).
+ * With lock coupling each directory is read locked before its entries are
+ * read and unlocked as soon as the next one is locked, so only the last
+ * inode stays locked. Otherwise all the ancestors stay read locked.
+ * Inodes the set already holds (the other parent of a move) are not
+ * locked again.
+ * Input:
+ *  - name: path of node
+ *  - set: lock set that receives the locks
+ *  - flag: lookup/create/delete = 0, move = 1
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ *    ABORT: if locking fails
+ *    RETRY: if a lock was busy, see lockset_lock
+ */
+int lookup_aux(char *name, LockSet *set, int flag) {
+	return lookup_from(FS_ROOT, name, set, flag);
+}
+
+/*
+ * Same as lookup_aux, but for a path relative to the i-node start.
+ * Input:
+ *  - start: identifier of the directory the path starts at
+ *  - name: path of node below start
+ *  - set: lock set that receives the locks
+ *  - flag: lookup/create/delete = 0, move = 1
+ * Returns: the same as lookup_aux
+ */
+static int lookup_from(int start, char *name, LockSet *set, int flag) {
+	char *full_path = path_copy(name);
 	char delim[] = "/";
 	char *saveptr;
+	int res;
 
-	strcpy(full_path, name);
-
-	/* start at root node */
-	int current_inumber = FS_ROOT, previous_inumber = FS_ROOT;
+	int current_inumber = start, next_inumber;
+	int held = lockset_holds(set, current_inumber);
 
 	/* use for copy */
 	type nType;
 	union Data data;
 
-	/* get root inode data */
-	inode_get(current_inumber, &nType, &data);
-
 	char *path = strtok_r(full_path, delim, &saveptr);
 
+	if ((res = lockset_lock(set, current_inumber, path == NULL && flag == MOVE)) != SUCCESS)
+		return res;
+
 	/* search for all sub nodes */
-	while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
+	while (path != NULL) {
+		char *next_path = strtok_r(NULL, delim, &saveptr);
+
 		inode_get(current_inumber, &nType, &data);
-		/* if flag = move and the inumber is already in the stack, it skips to prevent deadlocks */
-		if (flag && STACKcontains(stack, previous_inumber));
-		else if (rdlock(previous_inumber)) {
-			unlock(stack);
-			return ABORT;
+		if (nType != T_DIRECTORY || (next_inumber = lookup_sub_node(path, data.dir)) == FAIL)
+			break;
+
+		int next_held = lockset_holds(set, next_inumber);
+
+		if ((res = lockset_lock(set, next_inumber, next_path == NULL && flag == MOVE)) != SUCCESS)
+			return res;
+
+		/* a delete only read locks the parent, so the node may have been
+		 * removed while this thread waited for its lock */
+		if (!next_held && directory_lookup_again(data.dir, path) != next_inumber) {
+			if (lockset_unlock(set, next_inumber) != SUCCESS)
+				return ABORT;
+			break;
 		}
-		else
-			STACKpush(stack, previous_inumber);
-		previous_inumber = current_inumber;
-		path = strtok_r(NULL, delim, &saveptr);
-	}
 
-	/* if flag = move and the inumber is already in the stack, it skips to prevent deadlocks */
-	if (flag && STACKcontains(stack, previous_inumber));
-	else if (wrlock(previous_inumber)) {
-		unlock(stack);
-		return ABORT;
+		if (lock_coupling && !held && lockset_unlock(set, current_inumber) != SUCCESS)
+			return ABORT;
+
+		current_inumber = next_inumber;
+		held = next_held;
+		path = next_path;
 	}
-	else
-		STACKpush(stack, previous_inumber);
 
-	return current_inumber;
+	return path == NULL ? current_inumber : FAIL;
+}
+
+/*
+ * Write locks the parent directory of one side of a move, walking from
+ * their common ancestor.
+ * Returns: the same as lookup_aux
+ */
+static int move_lock_parent(int ancestor, char *rest, char *parent_name, LockSet *set) {
+	int inumber = lookup_from(ancestor, rest, set, MOVE);
+
+	if (inumber == FAIL)
+		fprintf(stderr, "Error: %s does not exist\n", parent_name);
+	return inumber;
 }
 
 /*
@@ -373,91 +926,200 @@ int lookup_aux(char *name, Stack stack, int flag) {
  * Input:
  *  - orig: original path of the child to be moved
  *  - dest: new path to where the child will be moved
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS, FAIL, or RETRY if it must be tried again
  */
-int move(char* orig, char* dest) {
+static int move_aux(char* orig, char* dest) {
 	int n = strcmp(dest, orig);
-	Stack stack = STACKinit(STACK_SIZE);
-	int dest_parent_inumber, orig_parent_inumber, orig_child_inumber;
-	char *dest_parent_name, *dest_child_name, *orig_parent_name, *orig_child_name, dest_name_copy[MAX_FILE_NAME], orig_name_copy[MAX_FILE_NAME];
+	unsigned long seq;
+	LockSet set;
+	int dest_parent_inumber, orig_parent_inumber, orig_child_inumber, ancestor_inumber, res;
+	type cType;
+	char *dest_parent_name, *dest_child_name, *orig_parent_name, *orig_child_name;
+	char *dest_name_copy = path_copy(dest), *orig_name_copy = path_copy(orig);
+	char *ancestor_name = arena_alloc(strlen(orig) + 1), *orig_rest, *dest_rest;
 	type pType;
 	union Data pdata;
 	char* common_path = strstr(dest, orig);
 
+	lockset_init(&set);
+
 	if (common_path == dest && n != 0) {
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		fprintf(stderr, "Error: %s is an invalid destination path\n", dest);
 		return FAIL;
 	}
 
-	strcpy(dest_name_copy, dest);
 	split_parent_child_from_path(dest_name_copy, &dest_parent_name, &dest_child_name);
 
-	strcpy(orig_name_copy, orig);
 	split_parent_child_from_path(orig_name_copy, &orig_parent_name, &orig_child_name);
 
-	if (n > 0) {
-		if ((orig_parent_inumber = lookup_aux(orig_parent_name, stack, MOVE)) == FAIL) {
-			if (unlock(stack)) return ABORT;
-			fprintf(stderr, "Error: %s does not exist\n", orig_parent_name);
-			return FAIL;
-		}
-		if ((dest_parent_inumber = lookup_aux(dest_parent_name, stack, MOVE)) == FAIL) {
-			if (unlock(stack)) return ABORT;
-			fprintf(stderr, "Error: %s does not exist\n", dest_parent_name);
-			return FAIL;
-		}
+	if (n == 0) {
+		if (unlock(&set)) return ABORT;
+		return SUCCESS;
 	}
-	else if (n < 0) {
-		if ((dest_parent_inumber = lookup_aux(dest_parent_name, stack, MOVE)) == FAIL) {
-			if (unlock(stack)) return ABORT;
-			fprintf(stderr, "Error: %s does not exist\n", dest_parent_name);
-			return FAIL;
-		}
-		if ((orig_parent_inumber = lookup_aux(orig_parent_name, stack, MOVE)) == FAIL) {
-			if (unlock(stack)) return ABORT;
-			fprintf(stderr, "Error: %s does not exist\n", orig_parent_name);
-			return FAIL;
-		}
+
+	/*
+	 * the path down to the common ancestor of both parents is only walked
+	 * once. If the ancestor is one of the parents it is write locked right
+	 * away, as the walk to the other one can't upgrade its lock later.
+	 */
+	int shared = split_common_ancestor(orig_parent_name, dest_parent_name, ancestor_name, &orig_rest, &dest_rest);
+	int ancestor_is_parent = *orig_rest == '\0' || *dest_rest == '\0';
+
+	if ((ancestor_inumber = lookup_aux(ancestor_name, &set, ancestor_is_parent ? MOVE : LOOKUP)) < 0) {
+		if (unlock(&set)) return ABORT;
+		if (ancestor_inumber == FAIL)
+			fprintf(stderr, "Error: %s does not exist\n", ancestor_name);
+		return ancestor_inumber;
+	}
+	stats_add(STAT_MOVE_SHARED_COMPONENTS, shared);
+	/* read while the ancestor is locked, so a move below it either already
+	 * counted or must still validate (see below) */
+	seq = __atomic_load_n(inode_renames(ancestor_inumber), __ATOMIC_ACQUIRE);
+
+	orig_parent_inumber = move_lock_parent(ancestor_inumber, orig_rest, orig_parent_name, &set);
+	dest_parent_inumber = orig_parent_inumber < 0 ? orig_parent_inumber :
+	                      move_lock_parent(ancestor_inumber, dest_rest, dest_parent_name, &set);
+
+	/* with lock coupling only the directories being changed stay locked */
+	if (lock_coupling && !ancestor_is_parent && orig_parent_inumber >= 0 && dest_parent_inumber >= 0 &&
+	    lockset_unlock(&set, ancestor_inumber) != SUCCESS) {
+		unlock(&set);
+		return ABORT;
+	}
+
+	if (orig_parent_inumber < 0 || dest_parent_inumber < 0) {
+		if (unlock(&set)) return ABORT;
+		return orig_parent_inumber < 0 ? orig_parent_inumber : dest_parent_inumber;
 	}
-	else
-		return SUCCESS;
 
 	inode_get(dest_parent_inumber, &pType, &pdata);
 
-	if (lookup_sub_node(dest_child_name, pdata.dirEntries) != FAIL) {
-		if (unlock(stack)) return ABORT;
+	if (pType != T_DIRECTORY) {
+		if (unlock(&set)) return ABORT;
+		fprintf(stderr, "Error: %s is not a directory\n", dest_parent_name);
+		return FAIL;
+	}
+
+	if (lookup_sub_node(dest_child_name, pdata.dir) != FAIL) {
+		if (unlock(&set)) return ABORT;
 		fprintf(stderr, "Error: %s already exists\n", dest);
 		return FAIL;
 	}
 
 	inode_get(orig_parent_inumber, &pType, &pdata);
 
-	if ((orig_child_inumber = lookup_sub_node(orig_child_name, pdata.dirEntries)) == FAIL) {
-		if (unlock(stack)) return ABORT;
+	if (pType != T_DIRECTORY) {
+		if (unlock(&set)) return ABORT;
+		fprintf(stderr, "Error: %s is not a directory\n", orig_parent_name);
+		return FAIL;
+	}
+
+	if ((orig_child_inumber = lookup_sub_node(orig_child_name, pdata.dir)) == FAIL) {
+		if (unlock(&set)) return ABORT;
 		fprintf(stderr, "Error: %s does not exist\n", orig);
 		return FAIL;
 	}
-	else {
-		wrlock(orig_child_inumber);
-		STACKpush(stack, orig_child_inumber);
+	else if ((res = lockset_lock(&set, orig_child_inumber, TRUE)) != SUCCESS) {
+		if (unlock(&set)) return ABORT;
+		return res;
+	}
+
+	/*
+	 * with lock coupling the ancestors were unlocked during the walks, so
+	 * another move may have changed the paths (and the checks above) since.
+	 * Only a move between two directories below the same common ancestor
+	 * can put one parent under the child moved to it (a cycle), so only one
+	 * move is validated per rename sequence of the ancestor and the others
+	 * walk again. Moves below other ancestors don't wait for each other.
+	 * The ancestor has a parent below it locked, so it can't be deleted.
+	 */
+	if (lock_coupling && !__atomic_compare_exchange_n(inode_renames(ancestor_inumber), &seq, seq + 1, FALSE,
+	                                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		if (unlock(&set)) return ABORT;
+		return RETRY;
 	}
 
-	if (dir_reset_entry(orig_parent_inumber, orig_child_inumber) == FAIL) {
-		if (unlock(stack)) return ABORT;
+	if (dir_reset_entry(orig_parent_inumber, orig_child_inumber, orig_child_name) == FAIL) {
+		if (unlock(&set)) return ABORT;
 		fprintf(stderr, "Error: %s does not exist\n", orig);
 		return FAIL;
 	}
 
 	if (dir_add_entry(dest_parent_inumber, orig_child_inumber, dest_child_name) == FAIL) {
 		dir_add_entry(orig_parent_inumber, orig_child_inumber, orig_child_name);
-		if (unlock(stack)) return ABORT;
+		if (unlock(&set)) return ABORT;
 		fprintf(stderr, "Error: destiny parent directory full\n");
 		return FAIL;
 	}
 
-	if (unlock(stack)) return ABORT;
+	/* everything cached below a moved directory now has a different path */
+	if (optimistic_reads) {
+		inode_get(orig_child_inumber, &cType, NULL);
+		if (cType == T_DIRECTORY)
+			dcache_invalidate_subtree(orig);
+		else
+			dcache_invalidate(orig);
+	}
+
+	if (unlock(&set)) return ABORT;
+
+	return SUCCESS;
+}
+
+/*
+ * If the input is valid, moves the child from orig to dest
+ * The move is tried again if a lock was busy (see lockset_lock) or if,
+ * with lock coupling, another move changed the paths meanwhile.
+ * Input:
+ *  - orig: original path of the child to be moved
+ *  - dest: new path to where the child will be moved
+ * Returns: SUCCESS or FAIL
+ */
+int move(char* orig, char* dest) {
+	int res, attempt = 0;
+	ArenaMark mark = arena_mark();
+
+	sync_lock(TRUE);
+	while ((res = move_aux(orig, dest)) == RETRY) {
+		stats_add(STAT_MOVE_RETRY, 1);
+		arena_release(mark);
+		lockset_backoff(attempt++);
+	}
+	sync_unlock();
+	arena_release(mark);
+	return res;
+}
+
+/*
+ * Write locks a directory and every directory below it, top-down. Holding
+ * only the root is not enough, as operations unlock the directories they
+ * don't change and the others are only read locked while being changed.
+ * Input:
+ *  - inumber: identifier of the directory
+ *  - set: lock set that receives the locks
+ * Returns: SUCCESS, ABORT or RETRY if a lock was busy
+ */
+static int lock_tree(int inumber, LockSet *set) {
+	type nType;
+	union Data data;
+	DirIterator it;
+	DirEntry *entry;
+	int res;
 
+	if ((res = lockset_lock(set, inumber, TRUE)) != SUCCESS)
+		return res;
+
+	inode_get(inumber, &nType, &data);
+	if (nType != T_DIRECTORY)
+		return SUCCESS;
+
+	directory_iter_init(&it, data.dir);
+	while ((entry = directory_iter_next(&it))) {
+		inode_get(entry->inumber, &nType, NULL);
+		if (nType == T_DIRECTORY && (res = lock_tree(entry->inumber, set)) != SUCCESS)
+			return res;
+	}
 	return SUCCESS;
 }
 
@@ -468,55 +1130,85 @@ int move(char* orig, char* dest) {
  */
 int print_tecnicofs_tree(char *outputfile) {
 	FILE* fileptr = openFile(outputfile, "w");
+	LockSet set;
+	int res, attempt = 0;
 
 	if (fileptr == NULL)
 		return ABORT;
 
-	wrlock(FS_ROOT);
-	
+	sync_lock(FALSE);
+	lockset_init(&set);
+	while ((res = lock_tree(FS_ROOT, &set)) == RETRY) {
+		unlock(&set);
+		lockset_backoff(attempt++);
+	}
+
+	if (res != SUCCESS) {
+		unlock(&set);
+		sync_unlock();
+		return ABORT;
+	}
 
 	inode_print_tree(fileptr, FS_ROOT, "");
 
-	if (pthread_rwlock_unlock(&inode_table[FS_ROOT].rwlock) != 0) {
-			fprintf(stderr, "Error: failed to unlock\n");
-			return ABORT;
-	}
+	res = unlock(&set);
+	sync_unlock();
+	if (res)
+		return ABORT;
 
 	return closeFile(fileptr, outputfile);
 }
 
 /*
- * Unlocks all the locks in the stack and frees all the memory associated with it
+ * Prints the server statistics.
  * Input:
- *   - stack: pointer to the stack
+ *  - outputfile: path of the output file
  */
-int unlock(Stack stack) {
-	int inumber;
+int print_tecnicofs_stats(char *outputfile) {
+	FILE* fileptr = openFile(outputfile, "w");
 
-	while((inumber = STACKpop(stack)) != FAIL)
-		if (pthread_rwlock_unlock(&inode_table[inumber].rwlock) != 0) {
-			fprintf(stderr, "Error: failed to unlock\n");
-			STACKfree(stack);
-			return ABORT;
-		}
+	if (fileptr == NULL)
+		return ABORT;
 
-	STACKfree(stack);
-	return SUCCESS;
-}
+	dcache_print_stats(fileptr);
+	directory_print_stats(fileptr);
+	reclaim_print_stats(fileptr);
+	slab_print_stats(fileptr);
+	extent_print_stats(fileptr);
+	arena_print_stats(fileptr);
+	hugepage_print_stats(fileptr);
+	fprintf(fileptr, "lookup: %lu optimistic walks, %lu retried because of a writer\n",
+	        stats_get(STAT_OPTIMISTIC_LOOKUP), stats_get(STAT_OPTIMISTIC_RETRY));
+	fprintf(fileptr, "move: %lu retries, %lu path components shared by both parents walked once\n",
+	        stats_get(STAT_MOVE_RETRY), stats_get(STAT_MOVE_SHARED_COMPONENTS));
+	fprintf(fileptr, "locks: %lu taken out of inumber order, %lu of them busy and retried\n",
+	        stats_get(STAT_LOCKSET_TRY), stats_get(STAT_LOCKSET_BACKOFF));
+	fprintf(fileptr, "brlock: %lu i-nodes switched to big-reader locks\n", stats_get(STAT_BRLOCK_SWITCHES));
+	fprintf(fileptr, "rangelock: %lu file reads and writes waited for an overlapping range\n",
+	        stats_get(STAT_RANGELOCK_WAITS));
+	fprintf(fileptr, "snapshot: %lu made for file maps, %lu bytes copied, %lu maps served by an earlier one\n",
+	        stats_get(STAT_SNAPSHOTS), stats_get(STAT_SNAPSHOT_BYTES), stats_get(STAT_SNAPSHOT_SHARED));
+	fprintf(fileptr, "applog: %lu bytes appended, %lu appends waited to publish, %lu folds of %lu bytes\n",
+	        stats_get(STAT_APPLOG_BYTES), stats_get(STAT_APPLOG_COMMIT_WAITS),
+	        stats_get(STAT_APPLOG_FOLDS), stats_get(STAT_APPLOG_FOLDED_BYTES));
+	fprintf(fileptr, "sync: %s\n", sync_strategy_name(sync_get_strategy()));
+	fprintf(fileptr, "rwlock: %s, %lu sleeps after spinning, %lu reader biases revoked\n",
+	        rwlock_kind_name(rwlock_get_kind()), stats_get(STAT_RWLOCK_SLEEPS), stats_get(STAT_RWLOCK_REVOCATIONS));
 
-int rdlock(int inumber) {
-	if (pthread_rwlock_rdlock(&inode_table[inumber].rwlock) != 0) {
-		fprintf(stderr, "Error: failed to lock\n");
-		return FAIL;
-	}
-	return SUCCESS;
+	return closeFile(fileptr, outputfile);
 }
 
-int wrlock(int inumber) {
-	if (pthread_rwlock_wrlock(&inode_table[inumber].rwlock) != 0) {
-		fprintf(stderr, "Error: failed to lock\n");
-		return FAIL;
-	}
+/*
+ * Unlocks all the locks in the set
+ * Input:
+ *   - set: pointer to the lock set
+ */
+int unlock(LockSet *set) {
+	if (lockset_release(set) != SUCCESS)
+		return ABORT;
+
+	/* hand what the operation retired to the reclaimer */
+	reclaim_flush();
 	return SUCCESS;
 }
 
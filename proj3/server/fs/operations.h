@@ -1,26 +1,49 @@
 #ifndef FS_H
 #define FS_H
 #include "state.h"
-#include "../stack.h"
+#include "dcache.h"
+#include "stats.h"
+#include "slab.h"
+#include "arena.h"
+#include "lockset.h"
+#include "sync.h"
+#include "compactor.h"
 
 #define FALSE 0
 #define TRUE 1
+#define LOOKUP 0
 #define CREATE 0
 #define DELETE 0
 #define MOVE 1
 
+/* optimistic walks tried before locking the path */
+#define OPTIMISTIC_TRIES 2
+/* components an optimistic walk keeps track of, deeper paths are locked */
+#define MAX_PATH_DEPTH 64
+
 void init_fs();
 void destroy_fs();
-int is_dir_empty(DirEntry *dirEntries);
+void set_lock_coupling(int enabled);
+void set_range_locking(int enabled);
+void set_shared_appends(int enabled);
+int is_dir_empty(Directory *dir);
 int create(char *name, type nodeType);
 int delete(char *name);
 int lookup(char *name);
-int lookup_aux(char *name, Stack stack, int flag);
+int lookup_optimistic(char *name);
+int file_open(char *name);
+int file_close(int inumber);
+int file_read(int inumber, char *buffer, int len, long offset);
+int file_write(int inumber, char *buffer, int len, long offset);
+int file_append(int inumber, char *buffer, int len, long *offset);
+int file_truncate(int inumber, long size);
+int file_map(int inumber, int *fd);
+int split_common_ancestor(char *a, char *b, char *ancestor, char **a_rest, char **b_rest);
+int lookup_aux(char *name, LockSet *set, int flag);
 int move(char* orig, char* dest);
 int print_tecnicofs_tree(char* outputfile);
-int unlock(Stack stack);
-int rdlock(int inumber);
-int wrlock(int inumber);
+int print_tecnicofs_stats(char* outputfile);
+int unlock(LockSet *set);
 FILE *openFile(char *filename, char *rw);
 int closeFile(FILE *file, char *filename);
 
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rangelock.h"
+#include "slab.h"
+#include "stats.h"
+
+static void mutex_lock(pthread_mutex_t *lock) {
+    if (pthread_mutex_lock(lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void mutex_unlock(pthread_mutex_t *lock) {
+    if (pthread_mutex_unlock(lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Checks if a range can't be locked yet.
+ * Returns: 1 if it overlaps a held range and one of the two writes, 0 otherwise
+ */
+static int rangelock_conflicts(RangeLock *lock, long start, long end, int write) {
+    for (Range *held = lock->held; held; held = held->next)
+        if (held->start < end && start < held->end && (write || held->write))
+            return 1;
+    return 0;
+}
+
+/*
+ * Creates a range lock with no ranges held.
+ * Returns: the lock
+ */
+RangeLock *rangelock_create() {
+    RangeLock *lock = slab_alloc(sizeof(RangeLock));
+
+    if (pthread_mutex_init(&lock->lock, NULL) != 0 || pthread_cond_init(&lock->released, NULL) != 0) {
+        fprintf(stderr, "Error: failed to initialize range lock\n");
+        exit(EXIT_FAILURE);
+    }
+    lock->held = NULL;
+    return lock;
+}
+
+/*
+ * Destroys a range lock, no range may be held.
+ */
+void rangelock_destroy(RangeLock *lock) {
+    if (pthread_mutex_destroy(&lock->lock) != 0 || pthread_cond_destroy(&lock->released) != 0) {
+        fprintf(stderr, "Error: failed to destroy range lock\n");
+        exit(EXIT_FAILURE);
+    }
+    slab_free(lock);
+}
+
+/*
+ * Locks the bytes [start, end), waiting until the overlapping ranges that
+ * conflict with it are unlocked. Empty ranges never wait.
+ * Input:
+ *  - lock: the range lock
+ *  - range: holds the range until rangelock_unlock
+ *  - start, end: the bytes to lock
+ *  - write: nonzero for a write lock, zero for a read lock
+ */
+void rangelock_lock(RangeLock *lock, Range *range, long start, long end, int write) {
+    range->start = start;
+    range->end = end;
+    range->write = write;
+
+    mutex_lock(&lock->lock);
+    if (rangelock_conflicts(lock, start, end, write)) {
+        stats_add(STAT_RANGELOCK_WAITS, 1);
+        do {
+            if (pthread_cond_wait(&lock->released, &lock->lock) != 0) {
+                fprintf(stderr, "Error: failed to wait for range lock\n");
+                exit(EXIT_FAILURE);
+            }
+        } while (rangelock_conflicts(lock, start, end, write));
+    }
+    range->next = lock->held;
+    lock->held = range;
+    mutex_unlock(&lock->lock);
+}
+
+/*
+ * Unlocks a range locked with rangelock_lock.
+ */
+void rangelock_unlock(RangeLock *lock, Range *range) {
+    Range **link;
+
+    mutex_lock(&lock->lock);
+    for (link = &lock->held; *link != range; link = &(*link)->next);
+    *link = range->next;
+    if (pthread_cond_broadcast(&lock->released) != 0) {
+        fprintf(stderr, "Error: failed to signal range lock\n");
+        exit(EXIT_FAILURE);
+    }
+    mutex_unlock(&lock->lock);
+}
@@ -0,0 +1,33 @@
+#ifndef RANGELOCK_H
+#define RANGELOCK_H
+
+#include <pthread.h>
+
+/*
+ * Byte-range lock of an open file. Each holder locks the bytes
+ * [start, end) it reads or writes, and only waits for the holders of
+ * overlapping ranges when one of them writes, so threads that use
+ * disjoint parts of a file run in parallel. The ranges are kept in a list
+ * under a mutex that is only held to scan and change it; the Range of each
+ * holder is declared on its stack.
+ * Range locks are taken before the i-node lock (see file_write).
+ */
+typedef struct range {
+	struct range *next;
+	long start, end;
+	int write;
+} Range;
+
+typedef struct rangeLock {
+	pthread_mutex_t lock;
+	pthread_cond_t released; /* signaled when a range is unlocked */
+	Range *held;
+} RangeLock;
+
+
+RangeLock *rangelock_create();
+void rangelock_destroy(RangeLock *lock);
+void rangelock_lock(RangeLock *lock, Range *range, long start, long end, int write);
+void rangelock_unlock(RangeLock *lock, Range *range);
+
+#endif /* RANGELOCK_H */
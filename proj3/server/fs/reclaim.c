@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "state.h"
+#include "reclaim.h"
+#include "stats.h"
+#include "slab.h"
+
+static unsigned long global_epoch = 1;
+static ReclaimRecord records[RECLAIM_MAX_THREADS];
+
+static __thread ReclaimRecord *thread_record = NULL;
+static __thread int thread_nesting = 0;
+static __thread Retired *thread_batch = NULL;
+static __thread int thread_registered = FALSE;
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+
+/* published batches, in publish order and so in epoch order */
+static Retired *retired_head = NULL, *retired_tail = NULL;
+static long backlog = 0, backlog_peak = 0;
+static unsigned long latency_max_us = 0;
+
+/* reclaimer thread state, all protected by reclaim_lock */
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reclaim_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t reclaim_done = PTHREAD_COND_INITIALIZER;
+static pthread_t reclaimer;
+static int running = FALSE;
+static int waiters = 0;
+
+static void reclaim_mutex_lock() {
+    if (pthread_mutex_lock(&reclaim_lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void reclaim_mutex_unlock() {
+    if (pthread_mutex_unlock(&reclaim_lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static unsigned long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/*
+ * Publishes the pending batch and releases the record of an exiting thread.
+ */
+static void thread_exit(void *arg) {
+    reclaim_flush();
+    if (thread_record) {
+        __atomic_store_n(&thread_record->state, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&thread_record->in_use, FALSE, __ATOMIC_RELEASE);
+        thread_record = NULL;
+    }
+}
+
+static void thread_key_init() {
+    if (pthread_key_create(&thread_key, thread_exit) != 0) {
+        fprintf(stderr, "Error: failed to create thread key\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Makes sure thread_exit runs when the calling thread exits.
+ */
+static void thread_register() {
+    if (thread_registered)
+        return;
+    pthread_once(&thread_once, thread_key_init);
+    pthread_setspecific(thread_key, &thread_registered);
+    thread_registered = TRUE;
+}
+
+/*
+ * Claims a free record for the calling thread.
+ */
+static void record_register() {
+    thread_register();
+
+    for (int i = 0; i < RECLAIM_MAX_THREADS; i++) {
+        int expected = FALSE;
+        if (__atomic_compare_exchange_n(&records[i].in_use, &expected, TRUE, FALSE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            thread_record = &records[i];
+            return;
+        }
+    }
+    fprintf(stderr, "Error: too many reader threads\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Starts a read section. Memory reachable from shared structures stays
+ * valid until the matching reclaim_exit. Sections may be nested.
+ */
+void reclaim_enter() {
+    if (thread_nesting++ > 0)
+        return;
+    if (!thread_record)
+        record_register();
+
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&thread_record->state, epoch << 1 | 1, __ATOMIC_RELAXED);
+    /* the epoch must be published before any shared pointer is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Ends a read section.
+ */
+void reclaim_exit() {
+    if (--thread_nesting > 0)
+        return;
+    __atomic_store_n(&thread_record->state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Advances the global epoch if every reader inside a read section has
+ * already seen the current one. Must be called with reclaim_lock held.
+ * Returns: TRUE if the epoch was advanced
+ */
+static int epoch_try_advance() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < RECLAIM_MAX_THREADS; i++) {
+        unsigned long state = __atomic_load_n(&records[i].state, __ATOMIC_ACQUIRE);
+        if ((state & 1) && (state >> 1) != epoch)
+            return FALSE;
+    }
+    __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+/*
+ * Runs a list of retired batches and accounts for their latency.
+ */
+static void retired_run(Retired *list) {
+    unsigned long freed = 0, latency_us = 0, now = now_ns(), max = 0;
+    Retired *next;
+
+    for (; list; list = next) {
+        unsigned long us = (now - list->retired_ns) / 1000;
+        next = list->next;
+        for (int i = 0; i < list->count; i++)
+            list->calls[i].fn(list->calls[i].arg);
+        freed += list->count;
+        latency_us += us * list->count;
+        if (us > max)
+            max = us;
+        slab_free(list);
+    }
+
+    stats_add(STAT_RECLAIM_FREED, freed);
+    stats_add(STAT_RECLAIM_LATENCY_US, latency_us);
+    if (max > __atomic_load_n(&latency_max_us, __ATOMIC_RELAXED))
+        __atomic_store_n(&latency_max_us, max, __ATOMIC_RELAXED);
+}
+
+/*
+ * Detaches the batches that no reader can reach anymore, or all of them
+ * if all is TRUE. Must be called with reclaim_lock held.
+ */
+static Retired *retired_detach(int all) {
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    Retired *list = retired_head, *last = NULL;
+
+    while (retired_head && (all || retired_head->epoch + 2 <= epoch)) {
+        backlog -= retired_head->count;
+        last = retired_head;
+        retired_head = retired_head->next;
+    }
+    if (!last)
+        return NULL;
+    last->next = NULL;
+    if (!retired_head)
+        retired_tail = NULL;
+    return list;
+}
+
+/*
+ * Background reclaimer: periodically advances the epoch and runs the
+ * callbacks whose grace period is over.
+ */
+static void *reclaimer_thread(void *arg) {
+    reclaim_mutex_lock();
+    while (running) {
+        if (backlog < RECLAIM_BACKLOG_WAKEUP && waiters == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += RECLAIM_INTERVAL_MS * 1000000l;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+            deadline.tv_nsec %= 1000000000l;
+            int err = pthread_cond_timedwait(&reclaim_wakeup, &reclaim_lock, &deadline);
+            if (err != 0 && err != ETIMEDOUT) {
+                fprintf(stderr, "Error: failed to wait on condition\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        int advanced = epoch_try_advance();
+        Retired *list = retired_detach(FALSE);
+        pthread_cond_broadcast(&reclaim_done);
+        reclaim_mutex_unlock();
+
+        retired_run(list);
+        /* a reader is holding the epoch back, let it run */
+        if (!advanced)
+            sched_yield();
+
+        reclaim_mutex_lock();
+    }
+    reclaim_mutex_unlock();
+    return NULL;
+}
+
+/*
+ * Starts the reclaimer thread.
+ */
+void reclaim_init() {
+    running = TRUE;
+    if (pthread_create(&reclaimer, NULL, reclaimer_thread, NULL) != 0) {
+        fprintf(stderr, "Error: failed to create reclaimer thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Stops the reclaimer thread and runs everything still retired. Only
+ * called once no reader is running; afterwards memory is released at once.
+ */
+void reclaim_destroy() {
+    reclaim_flush();
+    reclaim_mutex_lock();
+    if (!running) {
+        reclaim_mutex_unlock();
+        return;
+    }
+    running = FALSE;
+    pthread_cond_broadcast(&reclaim_wakeup);
+    pthread_cond_broadcast(&reclaim_done);
+    reclaim_mutex_unlock();
+
+    if (pthread_join(reclaimer, NULL) != 0) {
+        fprintf(stderr, "Error: failed to join reclaimer thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    reclaim_mutex_lock();
+    Retired *list = retired_detach(TRUE);
+    reclaim_mutex_unlock();
+    retired_run(list);
+}
+
+/*
+ * Publishes the calling thread's pending batch to the reclaimer.
+ * Writers call it at the end of each operation that retired something.
+ */
+void reclaim_flush() {
+    Retired *batch = thread_batch;
+
+    if (!batch)
+        return;
+    thread_batch = NULL;
+
+    reclaim_mutex_lock();
+    if (!running) {
+        reclaim_mutex_unlock();
+        retired_run(batch);
+        return;
+    }
+
+    /* read after the unlinks, readers that saw them are at this epoch or older */
+    batch->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    if (retired_tail)
+        retired_tail->next = batch;
+    else
+        retired_head = batch;
+    retired_tail = batch;
+
+    int wakeup = backlog < RECLAIM_BACKLOG_WAKEUP;
+    if ((backlog += batch->count) > backlog_peak)
+        backlog_peak = backlog;
+    if (wakeup && backlog >= RECLAIM_BACKLOG_WAKEUP)
+        pthread_cond_signal(&reclaim_wakeup);
+
+    /* the reclaimer is falling behind, help it instead of piling up more */
+    Retired *list = NULL;
+    if (backlog >= RECLAIM_BACKLOG_HELP) {
+        epoch_try_advance();
+        list = retired_detach(FALSE);
+    }
+    stats_add(STAT_RECLAIM_RETIRED, batch->count);
+    reclaim_mutex_unlock();
+
+    retired_run(list);
+}
+
+/*
+ * Calls fn(arg) once no reader can still be using what it releases.
+ * Input:
+ *  - fn: function that releases the memory
+ *  - arg: argument of fn, already unlinked from every shared structure
+ */
+void reclaim_call(void (*fn)(void *), void *arg) {
+    Retired *batch = thread_batch;
+
+    if (!__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        fn(arg);
+        return;
+    }
+
+    if (!batch) {
+        batch = slab_alloc(sizeof(Retired));
+        thread_register();
+        batch->next = NULL;
+        batch->count = 0;
+        batch->retired_ns = now_ns();
+        thread_batch = batch;
+    }
+
+    batch->calls[batch->count].fn = fn;
+    batch->calls[batch->count++].arg = arg;
+    if (batch->count == RECLAIM_BATCH)
+        reclaim_flush();
+}
+
+/*
+ * Frees memory once no reader can still be using it.
+ * Input:
+ *  - ptr: memory from slab_alloc, already unlinked from every shared structure
+ */
+void reclaim_free(void *ptr) {
+    reclaim_call(slab_free, ptr);
+}
+
+/*
+ * Waits for a grace period: every read section running when this is called
+ * has ended when it returns. Must not be called inside a read section.
+ */
+void reclaim_synchronize() {
+    reclaim_flush();
+
+    unsigned long target = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) + 2;
+
+    reclaim_mutex_lock();
+    waiters++;
+    pthread_cond_signal(&reclaim_wakeup);
+    while (running && __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) < target)
+        if (pthread_cond_wait(&reclaim_done, &reclaim_lock) != 0) {
+            fprintf(stderr, "Error: failed to wait on condition\n");
+            exit(EXIT_FAILURE);
+        }
+    waiters--;
+    reclaim_mutex_unlock();
+}
+
+/*
+ * Prints the reclamation statistics.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void reclaim_print_stats(FILE *fp) {
+    unsigned long freed = stats_get(STAT_RECLAIM_FREED);
+
+    reclaim_mutex_lock();
+    long current = backlog, peak = backlog_peak;
+    reclaim_mutex_unlock();
+
+    fprintf(fp, "reclaim: epoch %lu, %lu retired, %lu freed, backlog %ld (peak %ld)\n",
+            __atomic_load_n(&global_epoch, __ATOMIC_RELAXED), stats_get(STAT_RECLAIM_RETIRED),
+            freed, current, peak);
+    fprintf(fp, "reclaim: latency avg %.1f us, max %lu us\n",
+            freed ? (double)stats_get(STAT_RECLAIM_LATENCY_US) / freed : 0.0,
+            __atomic_load_n(&latency_max_us, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,63 @@
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stdio.h>
+
+/* threads that can be inside read sections at the same time */
+#define RECLAIM_MAX_THREADS 256
+
+/* callbacks a thread collects before publishing them to the reclaimer */
+#define RECLAIM_BATCH 32
+
+/* period of the reclaimer thread and backlog that wakes it up earlier */
+#define RECLAIM_INTERVAL_MS 10
+#define RECLAIM_BACKLOG_WAKEUP 1024
+/* backlog above which writers reclaim by themselves */
+#define RECLAIM_BACKLOG_HELP 8192
+
+/*
+ * Epoch-based reclamation of memory that lock-free readers may still be
+ * reading. Readers bracket their accesses with reclaim_enter/reclaim_exit
+ * and writers hand unlinked memory to reclaim_free (or reclaim_call)
+ * instead of releasing it. A background thread advances the global epoch
+ * once every reader has seen the current one, and runs what was retired
+ * two epochs before, when no reader can still reach it.
+ */
+typedef struct retiredCall {
+	void (*fn)(void *);
+	void *arg;
+} RetiredCall;
+
+/*
+ * Callbacks retired by one thread. Each thread fills a batch privately and
+ * publishes it when it is full or on reclaim_flush, so writers take the
+ * reclaimer's lock once per batch.
+ */
+typedef struct retired {
+	struct retired *next;
+	unsigned long epoch;      /* global epoch when it was published */
+	unsigned long retired_ns; /* time of the first retire, for the stats */
+	int count;
+	RetiredCall calls[RECLAIM_BATCH];
+} Retired;
+
+/*
+ * Per-thread reader state, one cache line each.
+ */
+typedef struct reclaimRecord {
+	unsigned long state; /* epoch << 1 | 1 inside a read section, 0 outside */
+	int in_use;
+} __attribute__((aligned(64))) ReclaimRecord;
+
+
+void reclaim_init();
+void reclaim_destroy();
+void reclaim_enter();
+void reclaim_exit();
+void reclaim_call(void (*fn)(void *), void *arg);
+void reclaim_free(void *ptr);
+void reclaim_flush();
+void reclaim_synchronize();
+void reclaim_print_stats(FILE *fp);
+
+#endif /* RECLAIM_H */
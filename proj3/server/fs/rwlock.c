@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "state.h"
+#include "stats.h"
+#include "rwlock.h"
+
+static char *kind_names[NRWLOCKKINDS] = {"pthread", "spin", "fair", "biased"};
+
+static rwlockKind kind = RWLOCK_PTHREAD;
+
+/* RWLOCK_BIASED: locks read by each thread through its slots */
+static RwLock *visible_readers[RWLOCK_BIAS_THREADS][RWLOCK_BIAS_WAYS] __attribute__((aligned(64)));
+static int next_bias_thread = 0;
+static __thread int bias_thread = -1;
+
+/*
+ * Finds the lock implementation with the given name.
+ * Returns: the kind, or FAIL if there is none
+ */
+int rwlock_kind_from_name(char *name) {
+    for (int i = 0; i < NRWLOCKKINDS; i++)
+        if (strcmp(name, kind_names[i]) == 0)
+            return i;
+    return FAIL;
+}
+
+char *rwlock_kind_name(int k) {
+    return kind_names[k];
+}
+
+/*
+ * Chooses the implementation of the locks initialized from now on. Must be
+ * called while no lock exists, before the file system is initialized.
+ */
+void rwlock_set_kind(int k) {
+    kind = k;
+}
+
+int rwlock_get_kind() {
+    return kind;
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static unsigned long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * RWLOCK_SPIN
+ * Sleeping threads wait for wakeups to change. A thread registers in
+ * waiters before it reads wakeups and checks the state for the last time,
+ * and unlock changes the state before reading waiters, so either the
+ * sleeper sees the lock free or unlock sees the sleeper and wakes it.
+ */
+
+static int spin_tryrdlock(RwLock *lock) {
+    unsigned int state = __atomic_load_n(&lock->spin.state, __ATOMIC_RELAXED);
+
+    return !(state & RWLOCK_WRITER) &&
+           __atomic_compare_exchange_n(&lock->spin.state, &state, state + 1, FALSE,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static int spin_trywrlock(RwLock *lock) {
+    unsigned int state = 0;
+
+    return __atomic_compare_exchange_n(&lock->spin.state, &state, RWLOCK_WRITER, FALSE,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void spin_lock(RwLock *lock, int (*try)(RwLock*)) {
+    for (int spins = 0; !try(lock); spins++) {
+        if (spins < RWLOCK_SPINS) {
+            cpu_relax();
+            continue;
+        }
+
+        __atomic_add_fetch(&lock->spin.waiters, 1, __ATOMIC_SEQ_CST);
+        unsigned int wakeups = __atomic_load_n(&lock->spin.wakeups, __ATOMIC_SEQ_CST);
+
+        if (try(lock)) {
+            __atomic_sub_fetch(&lock->spin.waiters, 1, __ATOMIC_SEQ_CST);
+            return;
+        }
+        stats_add(STAT_RWLOCK_SLEEPS, 1);
+        syscall(SYS_futex, &lock->spin.wakeups, FUTEX_WAIT_PRIVATE, wakeups, NULL, NULL, 0);
+        __atomic_sub_fetch(&lock->spin.waiters, 1, __ATOMIC_SEQ_CST);
+        spins = 0;
+    }
+}
+
+static void spin_unlock(RwLock *lock) {
+    unsigned int state = __atomic_load_n(&lock->spin.state, __ATOMIC_RELAXED);
+
+    /* a read lock can't be held while the writer bit is set */
+    if (state & RWLOCK_WRITER)
+        state = __atomic_and_fetch(&lock->spin.state, ~RWLOCK_WRITER, __ATOMIC_SEQ_CST);
+    else
+        state = __atomic_sub_fetch(&lock->spin.state, 1, __ATOMIC_SEQ_CST);
+
+    /* only writers wait for readers, so the last one wakes them */
+    if (state == 0 && __atomic_load_n(&lock->spin.waiters, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_add_fetch(&lock->spin.wakeups, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &lock->spin.wakeups, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+ * RWLOCK_BIASED
+ * Each of the first RWLOCK_BIAS_THREADS threads owns a line of
+ * visible_readers, and a lock always uses the same slot of each line.
+ * A reader stores the lock in its slot before checking rbias, and a writer
+ * clears rbias before checking the slots, so one of them always sees the
+ * other.
+ */
+
+static int bias_way(RwLock *lock) {
+    return ((uintptr_t)lock * 0x9E3779B97F4A7C15UL) >> 61;
+}
+
+static RwLock **bias_slot(RwLock *lock) {
+    if (bias_thread == -1)
+        bias_thread = __atomic_fetch_add(&next_bias_thread, 1, __ATOMIC_RELAXED);
+    if (bias_thread >= RWLOCK_BIAS_THREADS)
+        return NULL;
+    return &visible_readers[bias_thread][bias_way(lock)];
+}
+
+/*
+ * Read locks through the slot of the thread if the bias is on.
+ * Returns: TRUE if the lock is held
+ */
+static int bias_rdlock(RwLock *lock) {
+    if (!__atomic_load_n(&lock->rbias, __ATOMIC_RELAXED))
+        return FALSE;
+
+    RwLock **slot = bias_slot(lock);
+
+    if (!slot || *slot != NULL)
+        return FALSE;
+    __atomic_store_n(slot, lock, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&lock->rbias, __ATOMIC_SEQ_CST))
+        return TRUE;
+    __atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+    return FALSE;
+}
+
+/* after a read lock taken on the rwlock, turns the bias back on if allowed */
+static void bias_enable(RwLock *lock) {
+    if (!__atomic_load_n(&lock->rbias, __ATOMIC_RELAXED) &&
+        now_ns() >= __atomic_load_n(&lock->inhibit_until, __ATOMIC_RELAXED))
+        __atomic_store_n(&lock->rbias, TRUE, __ATOMIC_RELAXED);
+}
+
+/*
+ * Turns the bias off, with the rwlock write locked, and waits until the
+ * readers that went through their slots are gone.
+ * Input:
+ *  - lock: the lock
+ *  - wait: FALSE to give up instead of waiting (see rwlock_trywrlock)
+ * Returns: TRUE if there are no readers left
+ */
+static int bias_revoke(RwLock *lock, int wait) {
+    unsigned long start = now_ns();
+    int way = bias_way(lock);
+
+    __atomic_store_n(&lock->rbias, FALSE, __ATOMIC_SEQ_CST);
+    for (int t = 0; t < RWLOCK_BIAS_THREADS; t++)
+        while (__atomic_load_n(&visible_readers[t][way], __ATOMIC_SEQ_CST) == lock) {
+            if (!wait) {
+                __atomic_store_n(&lock->rbias, TRUE, __ATOMIC_RELAXED);
+                return FALSE;
+            }
+            sched_yield();
+        }
+
+    unsigned long end = now_ns();
+
+    __atomic_store_n(&lock->inhibit_until, end + (end - start) * RWLOCK_BIAS_INHIBIT, __ATOMIC_RELAXED);
+    stats_add(STAT_RWLOCK_REVOCATIONS, 1);
+    return TRUE;
+}
+
+/*
+ * Initializes an unlocked lock of the current kind.
+ * Returns: 0 or an error number
+ */
+int rwlock_init(RwLock *lock) {
+    pthread_rwlockattr_t attr;
+    int err;
+
+    lock->rbias = FALSE;
+    lock->inhibit_until = 0;
+
+    switch (kind) {
+        case RWLOCK_SPIN:
+            lock->spin.state = lock->spin.wakeups = lock->spin.waiters = 0;
+            return 0;
+        case RWLOCK_FAIR:
+            if ((err = pthread_rwlockattr_init(&attr)) != 0)
+                return err;
+            pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+            err = pthread_rwlock_init(&lock->rwlock, &attr);
+            pthread_rwlockattr_destroy(&attr);
+            return err;
+        case RWLOCK_BIASED:
+            lock->rbias = TRUE;
+            return pthread_rwlock_init(&lock->rwlock, NULL);
+        default:
+            return pthread_rwlock_init(&lock->rwlock, NULL);
+    }
+}
+
+int rwlock_destroy(RwLock *lock) {
+    return kind == RWLOCK_SPIN ? 0 : pthread_rwlock_destroy(&lock->rwlock);
+}
+
+/*
+ * Read locks the lock.
+ * Returns: 0 or an error number
+ */
+int rwlock_rdlock(RwLock *lock) {
+    int err;
+
+    switch (kind) {
+        case RWLOCK_SPIN:
+            spin_lock(lock, spin_tryrdlock);
+            return 0;
+        case RWLOCK_BIASED:
+            if (bias_rdlock(lock))
+                return 0;
+            if ((err = pthread_rwlock_rdlock(&lock->rwlock)) == 0)
+                bias_enable(lock);
+            return err;
+        default:
+            return pthread_rwlock_rdlock(&lock->rwlock);
+    }
+}
+
+/*
+ * Write locks the lock.
+ * Returns: 0 or an error number
+ */
+int rwlock_wrlock(RwLock *lock) {
+    int err;
+
+    switch (kind) {
+        case RWLOCK_SPIN:
+            spin_lock(lock, spin_trywrlock);
+            return 0;
+        case RWLOCK_BIASED:
+            if ((err = pthread_rwlock_wrlock(&lock->rwlock)) == 0 &&
+                __atomic_load_n(&lock->rbias, __ATOMIC_RELAXED))
+                bias_revoke(lock, TRUE);
+            return err;
+        default:
+            return pthread_rwlock_wrlock(&lock->rwlock);
+    }
+}
+
+/*
+ * Read locks the lock if no writer holds it.
+ * Returns: 0, EBUSY or another error number
+ */
+int rwlock_tryrdlock(RwLock *lock) {
+    int err;
+
+    switch (kind) {
+        case RWLOCK_SPIN:
+            return spin_tryrdlock(lock) ? 0 : EBUSY;
+        case RWLOCK_BIASED:
+            if (bias_rdlock(lock))
+                return 0;
+            if ((err = pthread_rwlock_tryrdlock(&lock->rwlock)) == 0)
+                bias_enable(lock);
+            return err;
+        default:
+            return pthread_rwlock_tryrdlock(&lock->rwlock);
+    }
+}
+
+/*
+ * Write locks the lock if nobody holds it. Never waits for biased readers,
+ * as they may be waiting for a lock the caller holds.
+ * Returns: 0, EBUSY or another error number
+ */
+int rwlock_trywrlock(RwLock *lock) {
+    int err;
+
+    switch (kind) {
+        case RWLOCK_SPIN:
+            return spin_trywrlock(lock) ? 0 : EBUSY;
+        case RWLOCK_BIASED:
+            if ((err = pthread_rwlock_trywrlock(&lock->rwlock)) != 0)
+                return err;
+            if (__atomic_load_n(&lock->rbias, __ATOMIC_RELAXED) && !bias_revoke(lock, FALSE)) {
+                pthread_rwlock_unlock(&lock->rwlock);
+                return EBUSY;
+            }
+            return 0;
+        default:
+            return pthread_rwlock_trywrlock(&lock->rwlock);
+    }
+}
+
+/*
+ * Unlocks the lock, held for reading or for writing.
+ * Returns: 0 or an error number
+ */
+int rwlock_unlock(RwLock *lock) {
+    RwLock **slot;
+
+    switch (kind) {
+        case RWLOCK_SPIN:
+            spin_unlock(lock);
+            return 0;
+        case RWLOCK_BIASED:
+            /* the thread never holds the same lock twice, so this is its read */
+            if ((slot = bias_slot(lock)) && *slot == lock) {
+                __atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+                return 0;
+            }
+            return pthread_rwlock_unlock(&lock->rwlock);
+        default:
+            return pthread_rwlock_unlock(&lock->rwlock);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include <pthread.h>
+
+/*
+ * Implementations of the i-node locks, chosen at startup:
+ *  - RWLOCK_PTHREAD: glibc's default rwlock, which prefers readers
+ *  - RWLOCK_SPIN: spins for a while and only then sleeps on a futex, for
+ *    critical sections shorter than a sleep and wake up
+ *  - RWLOCK_FAIR: glibc's rwlock preferring writers, so lookups can't
+ *    starve them
+ *  - RWLOCK_BIASED: while a lock is only read, readers just publish it in
+ *    a slot of their own instead of writing to the lock; the first writer
+ *    revokes the bias and waits for those readers (BRAVO)
+ */
+typedef enum rwlockKind {
+	RWLOCK_PTHREAD,
+	RWLOCK_SPIN,
+	RWLOCK_FAIR,
+	RWLOCK_BIASED,
+	NRWLOCKKINDS
+} rwlockKind;
+
+/* RWLOCK_SPIN: writer bit of the state, the other bits count readers */
+#define RWLOCK_WRITER 0x80000000u
+/* RWLOCK_SPIN: failed tries before sleeping */
+#define RWLOCK_SPINS 128
+
+/* RWLOCK_BIASED: threads with reader slots, the others always use the rwlock */
+#define RWLOCK_BIAS_THREADS 64
+/* RWLOCK_BIASED: slots per thread, one cache line */
+#define RWLOCK_BIAS_WAYS 8
+/* RWLOCK_BIASED: after a revocation the bias stays off for this many
+ * times the time the revocation took */
+#define RWLOCK_BIAS_INHIBIT 9
+
+typedef struct rwLock {
+	union {
+		pthread_rwlock_t rwlock; /* RWLOCK_PTHREAD, RWLOCK_FAIR and RWLOCK_BIASED */
+		struct {
+			unsigned int state;   /* readers and RWLOCK_WRITER */
+			unsigned int wakeups; /* futex word sleeping threads wait on */
+			unsigned int waiters; /* threads sleeping or about to */
+		} spin;                  /* RWLOCK_SPIN */
+	};
+	int rbias;                     /* RWLOCK_BIASED: readers may skip the rwlock */
+	unsigned long inhibit_until;   /* RWLOCK_BIASED: no bias before this (ns) */
+} RwLock;
+
+
+int rwlock_kind_from_name(char *name);
+char *rwlock_kind_name(int kind);
+void rwlock_set_kind(int kind);
+int rwlock_get_kind();
+int rwlock_init(RwLock *lock);
+int rwlock_destroy(RwLock *lock);
+int rwlock_rdlock(RwLock *lock);
+int rwlock_wrlock(RwLock *lock);
+int rwlock_tryrdlock(RwLock *lock);
+int rwlock_trywrlock(RwLock *lock);
+int rwlock_unlock(RwLock *lock);
+
+#endif /* RWLOCK_H */
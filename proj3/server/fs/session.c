@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "operations.h"
+#include "session.h"
+
+static Session *sessions[SESSION_BUCKETS];
+static pthread_rwlock_t sessions_lock;
+
+static void sessions_lock_table(int write) {
+    if ((write ? pthread_rwlock_wrlock(&sessions_lock) : pthread_rwlock_rdlock(&sessions_lock)) != 0) {
+        fprintf(stderr, "Error: failed to lock rwlock\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void sessions_unlock_table() {
+    if (pthread_rwlock_unlock(&sessions_lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock rwlock\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void session_lock(Session *session) {
+    if (pthread_mutex_lock(&session->lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void session_unlock(Session *session) {
+    if (pthread_mutex_unlock(&session->lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Drops a reference to a session, freeing it with the last one. The
+ * session must be unlocked.
+ */
+static void session_drop(Session *session) {
+    if (__atomic_sub_fetch(&session->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    if (pthread_mutex_destroy(&session->lock) != 0) {
+        fprintf(stderr, "Error: failed to destroy mutex\n");
+        exit(EXIT_FAILURE);
+    }
+    slab_free(session);
+}
+
+/*
+ * Unlocks a session returned by session_get and drops its reference.
+ */
+static void session_put(Session *session) {
+    session_unlock(session);
+    session_drop(session);
+}
+
+static Session *session_find(unsigned int bucket, char *client) {
+    Session *session = sessions[bucket];
+
+    while (session && strcmp(session->client, client) != 0)
+        session = session->next;
+    return session;
+}
+
+/*
+ * Finds the session of a client, optionally starting it. The reference
+ * taken under the table lock keeps the session alive while this thread
+ * waits for its lock, so a slow request of one client never holds the
+ * table from the others.
+ * Input:
+ *  - client: name of the client
+ *  - create: TRUE to start the session if there is none
+ * Returns: the session, locked, to be released with session_put, or NULL
+ */
+static Session *session_get(char *client, int create) {
+    unsigned int bucket = dir_hash(client) % SESSION_BUCKETS;
+
+    sessions_lock_table(FALSE);
+    Session *session = session_find(bucket, client);
+    if (session)
+        __atomic_add_fetch(&session->refs, 1, __ATOMIC_RELAXED);
+    sessions_unlock_table();
+
+    if (!session && !create)
+        return NULL;
+
+    if (!session) {
+        sessions_lock_table(TRUE);
+        /* another request of the client may have started it meanwhile */
+        if (!(session = session_find(bucket, client))) {
+            session = slab_alloc(sizeof(Session));
+            if (pthread_mutex_init(&session->lock, NULL) != 0) {
+                fprintf(stderr, "Error: failed to initialize mutex\n");
+                exit(EXIT_FAILURE);
+            }
+            session->refs = 1;
+            session->ended = FALSE;
+            strncpy(session->client, client, MAX_CLIENT_NAME - 1);
+            session->client[MAX_CLIENT_NAME - 1] = '\0';
+            for (int fd = 0; fd < MAX_OPEN_FILES; fd++)
+                session->files[fd].inumber = FREE_INODE;
+            session->next = sessions[bucket];
+            sessions[bucket] = session;
+        }
+        __atomic_add_fetch(&session->refs, 1, __ATOMIC_RELAXED);
+        sessions_unlock_table();
+    }
+
+    session_lock(session);
+    if (!session->ended)
+        return session;
+    /* ended while this thread waited, as if it had never been found */
+    session_put(session);
+    return session_get(client, create);
+}
+
+/*
+ * Returns the open file of a descriptor, or NULL if it is not open.
+ */
+static OpenFile *session_file(Session *session, int fd) {
+    if (!session || fd < 0 || fd >= MAX_OPEN_FILES || session->files[fd].inumber == FREE_INODE ||
+        session->files[fd].closing)
+        return NULL;
+    return &session->files[fd];
+}
+
+/*
+ * Closes the file of a descriptor, or leaves it to the last request still
+ * using it (see session_done). The session must be locked.
+ * Returns: SUCCESS or ABORT
+ */
+static int session_file_close(OpenFile *file) {
+    int res = SUCCESS;
+
+    if (file->users > 0)
+        file->closing = TRUE;
+    else {
+        res = file_close(file->inumber);
+        file->inumber = FREE_INODE;
+    }
+    return res;
+}
+
+/*
+ * Takes a descriptor for one read, write, truncate or map. Only copying it
+ * needs the session's lock, so requests of a client on different files,
+ * or on the same one, don't wait for each other's I/O. The file stays open
+ * until session_done, even if the descriptor is closed meanwhile.
+ * Input:
+ *  - client: name of the client
+ *  - fd: the descriptor
+ *  - access: READ or WRITE, what the descriptor must allow
+ *  - session: receives the session, to pass to session_done
+ *  - copy: receives the open file as it was
+ * Returns: SUCCESS, TECNICOFS_ERROR_FILE_NOT_OPEN or
+ *  TECNICOFS_ERROR_INVALID_MODE, session_done is only needed on SUCCESS
+ */
+static int session_use(char *client, int fd, permission access, Session **session, OpenFile *copy) {
+    OpenFile *file;
+    int res = SUCCESS;
+
+    if (!(*session = session_get(client, FALSE)))
+        return TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+    if (!(file = session_file(*session, fd)))
+        res = TECNICOFS_ERROR_FILE_NOT_OPEN;
+    else if (!(file->mode & access))
+        res = TECNICOFS_ERROR_INVALID_MODE;
+    else {
+        file->users++;
+        *copy = *file;
+    }
+
+    if (res == SUCCESS)
+        session_unlock(*session);
+    else
+        session_put(*session);
+    return res;
+}
+
+/*
+ * Ends a request that took a descriptor with session_use, moving its
+ * offset. Requests running on one descriptor at once each started from the
+ * offset they found, the one that ends last sets it.
+ * Input:
+ *  - session, fd: as given to session_use
+ *  - offset: new offset of the descriptor, or -1 to keep it
+ * Returns: SUCCESS, or ABORT if the descriptor was closed meanwhile and
+ *  closing the file failed
+ */
+static int session_done(Session *session, int fd, long offset) {
+    OpenFile *file = &session->files[fd];
+    int res = SUCCESS;
+
+    session_lock(session);
+    if (offset >= 0 && !file->closing)
+        file->offset = offset;
+    if (--file->users == 0 && file->closing) {
+        file->closing = FALSE;
+        res = session_file_close(file);
+    }
+    session_put(session);
+    return res;
+}
+
+/*
+ * Initializes the session table.
+ */
+void session_init() {
+    memset(sessions, 0, sizeof(sessions));
+    if (pthread_rwlock_init(&sessions_lock, NULL) != 0) {
+        fprintf(stderr, "Error: failed to initialize rwlock\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Ends every session.
+ */
+void session_destroy() {
+    for (int bucket = 0; bucket < SESSION_BUCKETS; bucket++)
+        while (sessions[bucket])
+            session_end(sessions[bucket]->client);
+
+    if (pthread_rwlock_destroy(&sessions_lock) != 0) {
+        fprintf(stderr, "Error: failed to destroy rwlock\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Opens a file for a client.
+ * Input:
+ *  - client: name of the client
+ *  - path: path of the file
+ *  - mode: READ, WRITE or RW, WRITE and RW with APPEND too
+ * Returns:
+ *  - fd: descriptor of the open file
+ *  - TECNICOFS_ERROR_INVALID_MODE, TECNICOFS_ERROR_MAXED_OPEN_FILES or an
+ *    error of file_open
+ */
+int session_open(char *client, char *path, permission mode) {
+    permission access = mode & ~APPEND;
+
+    if ((access != READ && access != WRITE && access != RW) || ((mode & APPEND) && !(mode & WRITE)))
+        return TECNICOFS_ERROR_INVALID_MODE;
+
+    Session *session = session_get(client, TRUE);
+    int fd = 0;
+
+    while (fd < MAX_OPEN_FILES && session->files[fd].inumber != FREE_INODE)
+        fd++;
+
+    if (fd == MAX_OPEN_FILES) {
+        session_put(session);
+        return TECNICOFS_ERROR_MAXED_OPEN_FILES;
+    }
+
+    int inumber = file_open(path);
+
+    if (inumber >= 0) {
+        session->files[fd].inumber = inumber;
+        session->files[fd].mode = mode;
+        session->files[fd].offset = 0;
+        session->files[fd].users = 0;
+        session->files[fd].closing = FALSE;
+    }
+    session_put(session);
+    return inumber >= 0 ? fd : inumber;
+}
+
+/*
+ * Closes a client's descriptor.
+ * Returns: SUCCESS, TECNICOFS_ERROR_FILE_NOT_OPEN or ABORT
+ */
+int session_close(char *client, int fd) {
+    Session *session = session_get(client, FALSE);
+    OpenFile *file = session_file(session, fd);
+    int res = TECNICOFS_ERROR_FILE_NOT_OPEN;
+
+    if (file)
+        res = session_file_close(file);
+    if (session)
+        session_put(session);
+    return res;
+}
+
+/*
+ * Reads from a client's descriptor, starting where the last read or write
+ * ended.
+ * Input:
+ *  - client: name of the client
+ *  - fd: descriptor open for reading
+ *  - buffer: receives the data
+ *  - len: maximum number of bytes to read
+ * Returns:
+ *  - the number of bytes read, 0 at the end of the file
+ *  - TECNICOFS_ERROR_FILE_NOT_OPEN or TECNICOFS_ERROR_INVALID_MODE
+ */
+int session_read(char *client, int fd, char *buffer, int len) {
+    Session *session;
+    OpenFile file;
+    int res;
+
+    if ((res = session_use(client, fd, READ, &session, &file)) != SUCCESS)
+        return res;
+
+    res = file_read(file.inumber, buffer, len, file.offset);
+    if (session_done(session, fd, res > 0 ? file.offset + res : -1) != SUCCESS)
+        res = ABORT;
+    return res;
+}
+
+/*
+ * Writes to a client's descriptor, starting where the last read or write
+ * ended, or at the end of the file if it was opened with APPEND (see
+ * file_append).
+ * Input:
+ *  - client: name of the client
+ *  - fd: descriptor open for writing
+ *  - buffer: data to write
+ *  - len: number of bytes to write
+ * Returns:
+ *  - the number of bytes written
+ *  - TECNICOFS_ERROR_FILE_NOT_OPEN, TECNICOFS_ERROR_INVALID_MODE or an
+ *    error of file_write
+ */
+int session_write(char *client, int fd, char *buffer, int len) {
+    Session *session;
+    OpenFile file;
+    long offset = -1;
+    int res;
+
+    if ((res = session_use(client, fd, WRITE, &session, &file)) != SUCCESS)
+        return res;
+
+    if (file.mode & APPEND) {
+        if ((res = file_append(file.inumber, buffer, len, &offset)) >= 0)
+            offset += res;
+    }
+    else if ((res = file_write(file.inumber, buffer, len, file.offset)) > 0)
+        offset = file.offset + res;
+
+    if (session_done(session, fd, offset) != SUCCESS)
+        res = ABORT;
+    return res;
+}
+
+/*
+ * Changes the size of the file of a client's descriptor, which keeps its
+ * offset.
+ * Input:
+ *  - client: name of the client
+ *  - fd: descriptor open for writing
+ *  - size: new size of the file
+ * Returns:
+ *  - SUCCESS
+ *  - TECNICOFS_ERROR_FILE_NOT_OPEN, TECNICOFS_ERROR_INVALID_MODE or an
+ *    error of file_truncate
+ */
+int session_truncate(char *client, int fd, long size) {
+    Session *session;
+    OpenFile file;
+    int res;
+
+    if ((res = session_use(client, fd, WRITE, &session, &file)) != SUCCESS)
+        return res;
+
+    res = file_truncate(file.inumber, size);
+    if (session_done(session, fd, -1) != SUCCESS)
+        res = ABORT;
+    return res;
+}
+
+/*
+ * Gets the whole contents of the file of a client's descriptor as a sealed
+ * memfd, see file_map. The offset of the descriptor doesn't change.
+ * Input:
+ *  - client: name of the client
+ *  - fd: descriptor open for reading
+ *  - memfd: receives the descriptor to pass to the client, -1 on errors
+ * Returns:
+ *  - the size of the file
+ *  - TECNICOFS_ERROR_FILE_NOT_OPEN, TECNICOFS_ERROR_INVALID_MODE or an
+ *    error of file_map
+ */
+int session_map(char *client, int fd, int *memfd) {
+    Session *session;
+    OpenFile file;
+    int res;
+
+    *memfd = -1;
+    if ((res = session_use(client, fd, READ, &session, &file)) != SUCCESS)
+        return res;
+
+    res = file_map(file.inumber, memfd);
+    if (session_done(session, fd, -1) != SUCCESS)
+        res = ABORT;
+    return res;
+}
+
+/*
+ * Ends the session of a client, closing the files it left open.
+ * Returns: SUCCESS
+ */
+int session_end(char *client) {
+    unsigned int bucket = dir_hash(client) % SESSION_BUCKETS;
+    Session **link, *session;
+
+    sessions_lock_table(TRUE);
+    for (link = &sessions[bucket]; *link && strcmp((*link)->client, client) != 0; link = &(*link)->next);
+    if ((session = *link))
+        *link = session->next;
+    sessions_unlock_table();
+
+    if (!session)
+        return SUCCESS;
+
+    /* requests that found the session before it was removed still hold a
+     * reference, and look it up again once they get the lock */
+    session_lock(session);
+    session->ended = TRUE;
+    for (int fd = 0; fd < MAX_OPEN_FILES; fd++)
+        if (session->files[fd].inumber != FREE_INODE && !session->files[fd].closing)
+            session_file_close(&session->files[fd]);
+    /* and drops the table's reference */
+    session_put(session);
+    return SUCCESS;
+}
@@ -0,0 +1,55 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <pthread.h>
+#include <sys/un.h>
+#include "../tecnicofs-api-constants.h"
+
+/* files each client may have open at once */
+#define MAX_OPEN_FILES 5
+
+/* buckets of the session table */
+#define SESSION_BUCKETS 64
+
+/* length of a client name, the path of its socket */
+#define MAX_CLIENT_NAME sizeof(((struct sockaddr_un*)0)->sun_path)
+
+/*
+ * Entry of a session's open-file table, a descriptor is its index
+ */
+typedef struct openFile {
+	int inumber; /* FREE_INODE if the descriptor is not in use */
+	permission mode;
+	long offset; /* where the next read or write starts */
+	int users; /* reads, writes, truncates and maps running, see session_use */
+	int closing; /* closed while in use, the last user closes the file */
+} OpenFile;
+
+/*
+ * Clients are identified by the path of their socket. A session starts with
+ * the first file a client opens and ends when it unmounts, mounts again or
+ * can no longer be replied to, closing whatever it left open. Descriptors refer to i-nodes directly, so reads and writes
+ * never walk or lock the path again (see file_read and file_write), and
+ * run without the session's lock (see session_use).
+ */
+typedef struct session {
+	struct session *next;
+	pthread_mutex_t lock; /* held while the open files are used or changed */
+	int refs; /* one for the table and one per request using it, see session_put */
+	int ended; /* removed from the table by session_end */
+	char client[MAX_CLIENT_NAME];
+	OpenFile files[MAX_OPEN_FILES];
+} Session;
+
+
+void session_init();
+void session_destroy();
+int session_open(char *client, char *path, permission mode);
+int session_close(char *client, int fd);
+int session_read(char *client, int fd, char *buffer, int len);
+int session_write(char *client, int fd, char *buffer, int len);
+int session_truncate(char *client, int fd, long size);
+int session_map(char *client, int fd, int *memfd);
+int session_end(char *client);
+
+#endif /* SESSION_H */
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "state.h"
+#include "stats.h"
+#include "slab.h"
+
+static const size_t class_sizes[SLAB_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 8192, 16384
+};
+
+static SlabClass classes[SLAB_CLASSES];
+/* class of each size up to SLAB_MAX_SIZE, in steps of 16 bytes */
+static unsigned char class_index[SLAB_MAX_SIZE / 16 + 1];
+
+/* regions chunks are carved from, released by slab_destroy */
+static char **regions = NULL, *region_next = NULL, *region_end = NULL;
+static int region_count = 0, region_max = 0;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+/* bumped by slab_destroy, so that threads drop their caches */
+static unsigned long slab_gen = 1;
+static unsigned long large_bytes = 0;
+
+static __thread SlabCache slab_cache;
+static pthread_key_t slab_cache_key;
+static pthread_once_t slab_cache_once = PTHREAD_ONCE_INIT;
+
+static void mutex_lock(pthread_mutex_t *lock) {
+    if (pthread_mutex_lock(lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void mutex_unlock(pthread_mutex_t *lock) {
+    if (pthread_mutex_unlock(lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Allocates a chunk of its own for a large object, aligned to
+ * SLAB_CHUNK_SIZE.
+ * Input:
+ *  - size: size of the chunk, header included
+ * Returns: pointer to the chunk
+ */
+static SlabChunk *chunk_create_large(size_t size) {
+    SlabChunk *chunk;
+
+    if (posix_memalign((void**)&chunk, SLAB_CHUNK_SIZE, size) != 0) {
+        fprintf(stderr, "Error: memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    chunk->class = SLAB_LARGE;
+    chunk->size = size;
+    stats_add(STAT_SYSTEM_ALLOCS, 1);
+    return chunk;
+}
+
+/*
+ * Takes a chunk for a size class from the current region, mapping a new
+ * region once it is used up.
+ * Input:
+ *  - class: class of its objects
+ * Returns: pointer to the chunk
+ */
+static SlabChunk *chunk_create(int class) {
+    mutex_lock(&regions_lock);
+
+    if (region_next == region_end) {
+        if (region_count == region_max) {
+            region_max = region_max ? 2 * region_max : 16;
+            if (!(regions = realloc(regions, region_max * sizeof(char*)))) {
+                fprintf(stderr, "Error: memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        region_next = regions[region_count++] = hugepage_alloc(SLAB_REGION_SIZE);
+        region_end = region_next + SLAB_REGION_SIZE;
+        stats_add(STAT_SYSTEM_ALLOCS, 1);
+    }
+
+    SlabChunk *chunk = (SlabChunk*)region_next;
+
+    region_next += SLAB_CHUNK_SIZE;
+    mutex_unlock(&regions_lock);
+
+    chunk->class = class;
+    chunk->size = SLAB_CHUNK_SIZE;
+    return chunk;
+}
+
+static SlabChunk *chunk_of(void *ptr) {
+    return (SlabChunk*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+}
+
+/*
+ * Takes free objects from the depot of a class, carving a new chunk into
+ * it if it is empty.
+ * Input:
+ *  - class: size class
+ *  - objects: array for the objects
+ *  - max: number of objects wanted
+ * Returns: number of objects taken, at least one
+ */
+static int depot_get(int class, void **objects, int max) {
+    SlabClass *c = &classes[class];
+    int count = 0;
+
+    mutex_lock(&c->lock);
+
+    if (!c->depot) {
+        SlabChunk *chunk = chunk_create(class);
+        char *object = (char*)chunk + SLAB_HEADER;
+
+        for (; object + c->size <= (char*)chunk + SLAB_CHUNK_SIZE; object += c->size) {
+            *(void**)object = c->depot;
+            c->depot = object;
+            c->depot_count++;
+        }
+        c->chunks++;
+    }
+
+    for (; count < max && c->depot; count++) {
+        objects[count] = c->depot;
+        c->depot = *(void**)c->depot;
+        c->depot_count--;
+    }
+
+    mutex_unlock(&c->lock);
+    return count;
+}
+
+/*
+ * Returns free objects to the depot of their class.
+ */
+static void depot_put(int class, void **objects, int count) {
+    SlabClass *c = &classes[class];
+
+    mutex_lock(&c->lock);
+    for (int i = 0; i < count; i++) {
+        *(void**)objects[i] = c->depot;
+        c->depot = objects[i];
+    }
+    c->depot_count += count;
+    mutex_unlock(&c->lock);
+}
+
+/*
+ * Returns the objects cached by an exiting thread to the depots. Objects
+ * it frees from now on (e.g. in other destructors) go there directly.
+ */
+static void slab_cache_flush(void *arg) {
+    slab_cache.exiting = TRUE;
+    if (slab_cache.gen != __atomic_load_n(&slab_gen, __ATOMIC_ACQUIRE))
+        return;
+    for (int class = 0; class < SLAB_CLASSES; class++) {
+        depot_put(class, slab_cache.objects[class], slab_cache.count[class]);
+        slab_cache.count[class] = 0;
+    }
+}
+
+static void slab_cache_key_init() {
+    if (pthread_key_create(&slab_cache_key, slab_cache_flush) != 0) {
+        fprintf(stderr, "Error: failed to create thread key\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Returns the calling thread's cache, emptied if its objects belong to
+ * chunks released since it was filled.
+ */
+static SlabCache *slab_cache_get() {
+    unsigned long gen = __atomic_load_n(&slab_gen, __ATOMIC_ACQUIRE);
+
+    if (slab_cache.gen != gen) {
+        memset(slab_cache.count, 0, sizeof(slab_cache.count));
+        slab_cache.gen = gen;
+        if (!slab_cache.registered) {
+            pthread_once(&slab_cache_once, slab_cache_key_init);
+            pthread_setspecific(slab_cache_key, &slab_cache);
+            slab_cache.registered = TRUE;
+        }
+    }
+    return &slab_cache;
+}
+
+/*
+ * Initializes the size classes. Must be called before any allocation.
+ */
+void slab_init() {
+    for (int class = 0, size = 0; size <= SLAB_MAX_SIZE; size += 16) {
+        while (class_sizes[class] < size)
+            class++;
+        class_index[size / 16] = class;
+    }
+
+    for (int class = 0; class < SLAB_CLASSES; class++) {
+        classes[class].size = class_sizes[class];
+        classes[class].depot = NULL;
+        classes[class].depot_count = 0;
+        classes[class].chunks = 0;
+        if (pthread_mutex_init(&classes[class].lock, NULL) != 0) {
+            fprintf(stderr, "Error: failed to initialize mutex\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+ * Releases every chunk. Only called once no object is in use anymore.
+ */
+void slab_destroy() {
+    for (int i = 0; i < region_count; i++)
+        hugepage_release(regions[i], SLAB_REGION_SIZE);
+    free(regions);
+    regions = NULL;
+    region_next = region_end = NULL;
+    region_count = region_max = 0;
+
+    for (int class = 0; class < SLAB_CLASSES; class++)
+        if (pthread_mutex_destroy(&classes[class].lock) != 0) {
+            fprintf(stderr, "Error: failed to destroy mutex\n");
+            exit(EXIT_FAILURE);
+        }
+    __atomic_add_fetch(&slab_gen, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Allocates an object.
+ * Input:
+ *  - size: size of the object
+ * Returns: pointer to the object, aligned to 16 bytes
+ */
+void *slab_alloc(size_t size) {
+    if (size > SLAB_MAX_SIZE) {
+        SlabChunk *chunk = chunk_create_large(SLAB_HEADER + size);
+
+        __atomic_add_fetch(&large_bytes, chunk->size, __ATOMIC_RELAXED);
+        return (char*)chunk + SLAB_HEADER;
+    }
+
+    int class = class_index[(size + 15) / 16];
+    SlabCache *cache = slab_cache_get();
+
+    if (cache->count[class] == 0) {
+        cache->count[class] = depot_get(class, cache->objects[class], cache->exiting ? 1 : SLAB_CACHE_BATCH);
+        stats_add(STAT_SLAB_REFILLS, 1);
+    }
+    stats_add(STAT_SLAB_ALLOCS, 1);
+    return cache->objects[class][--cache->count[class]];
+}
+
+/*
+ * Allocates an object filled with zeros, see slab_alloc.
+ */
+void *slab_calloc(size_t size) {
+    void *ptr = slab_alloc(size);
+
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/*
+ * Frees an object allocated by slab_alloc, from any thread.
+ * Input:
+ *  - ptr: pointer to the object, or NULL
+ */
+void slab_free(void *ptr) {
+    if (!ptr)
+        return;
+
+    SlabChunk *chunk = chunk_of(ptr);
+
+    if (chunk->class == SLAB_LARGE) {
+        __atomic_sub_fetch(&large_bytes, chunk->size, __ATOMIC_RELAXED);
+        free(chunk);
+        return;
+    }
+
+    int class = chunk->class;
+    SlabCache *cache = slab_cache_get();
+
+    cache->objects[class][cache->count[class]++] = ptr;
+    stats_add(STAT_SLAB_FREES, 1);
+
+    if (cache->exiting) {
+        depot_put(class, cache->objects[class], cache->count[class]);
+        cache->count[class] = 0;
+    }
+    else if (cache->count[class] == SLAB_CACHE_SIZE) {
+        cache->count[class] -= SLAB_CACHE_BATCH;
+        depot_put(class, &cache->objects[class][cache->count[class]], SLAB_CACHE_BATCH);
+        stats_add(STAT_SLAB_FLUSHES, 1);
+    }
+}
+
+/*
+ * Returns: the memory taken by an object of the given size, i.e. the size
+ * of its class, or of its chunk for large objects
+ */
+size_t slab_size(size_t size) {
+    if (size > SLAB_MAX_SIZE)
+        return SLAB_HEADER + size;
+    return class_sizes[class_index[(size + 15) / 16]];
+}
+
+/*
+ * Prints the allocator statistics.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void slab_print_stats(FILE *fp) {
+    fprintf(fp, "slab: %lu allocations, %lu frees, %lu cache refills, %lu cache flushes, %lu system allocations\n",
+            stats_get(STAT_SLAB_ALLOCS), stats_get(STAT_SLAB_FREES), stats_get(STAT_SLAB_REFILLS),
+            stats_get(STAT_SLAB_FLUSHES), stats_get(STAT_SYSTEM_ALLOCS));
+
+    for (int class = 0; class < SLAB_CLASSES; class++) {
+        SlabClass *c = &classes[class];
+
+        mutex_lock(&c->lock);
+        if (c->chunks > 0)
+            fprintf(fp, "slab: %5zu-byte objects, %lu chunks, %lu free in depot\n",
+                    c->size, c->chunks, c->depot_count);
+        mutex_unlock(&c->lock);
+    }
+    fprintf(fp, "slab: %lu KB in large objects\n", __atomic_load_n(&large_bytes, __ATOMIC_RELAXED) / 1024);
+}
@@ -0,0 +1,72 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "hugepage.h"
+
+/*
+ * Size-class allocator for the file system's objects (directories, their
+ * tables and entries, dcache entries, file contents, reclaim batches).
+ * Objects are carved from SLAB_CHUNK_SIZE chunks aligned to their size, so
+ * slab_free finds an object's class in the header of its chunk. Chunks are
+ * in turn carved from SLAB_REGION_SIZE regions backed by huge pages when
+ * possible (see hugepage.h), so a warm server touches few pages. Each thread
+ * keeps a cache of free objects per class and moves them from and to the
+ * shared depot of the class SLAB_CACHE_BATCH at a time, so once the server
+ * is warm the request path never calls malloc.
+ */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_REGION_SIZE HUGEPAGE_SIZE
+#define SLAB_HEADER 64
+#define SLAB_CLASSES 18
+#define SLAB_MAX_SIZE 16384
+/* objects above SLAB_MAX_SIZE get a chunk of their own */
+#define SLAB_LARGE -1
+
+#define SLAB_CACHE_SIZE 64
+#define SLAB_CACHE_BATCH 32
+
+/*
+ * Start of every chunk, padded to SLAB_HEADER bytes
+ */
+typedef struct slabChunk {
+	int class; /* or SLAB_LARGE */
+	size_t size; /* of the chunk */
+} SlabChunk;
+
+/*
+ * Shared state of a size class. Free objects in the depot are linked
+ * through their first word.
+ */
+typedef struct slabClass {
+	pthread_mutex_t lock;
+	size_t size;
+	void *depot;
+	unsigned long depot_count;
+	unsigned long chunks;
+} __attribute__((aligned(64))) SlabClass;
+
+/*
+ * Free objects kept by one thread. The cache is dropped when gen shows
+ * that slab_destroy released the chunks it points to.
+ */
+typedef struct slabCache {
+	unsigned long gen;
+	int registered;
+	int exiting; /* the thread is exiting, frees go straight to the depot */
+	int count[SLAB_CLASSES];
+	void *objects[SLAB_CLASSES][SLAB_CACHE_SIZE];
+} SlabCache;
+
+
+void slab_init();
+void slab_destroy();
+void *slab_alloc(size_t size);
+void *slab_calloc(size_t size);
+void slab_free(void *ptr);
+size_t slab_size(size_t size);
+void slab_print_stats(FILE *fp);
+
+#endif /* SLAB_H */
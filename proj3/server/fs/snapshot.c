@@ -0,0 +1,55 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "state.h"
+#include "stats.h"
+#include "snapshot.h"
+
+/*
+ * Creates an empty snapshot and maps it to be filled.
+ * Input:
+ *  - size: size of the contents
+ *  - contents: receives the writable mapping, NULL if size is 0
+ * Returns: descriptor of the snapshot, or FAIL if the system has no more
+ * descriptors or memory for it
+ */
+int snapshot_create(long size, char **contents) {
+    int fd = memfd_create("tecnicofs-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    *contents = NULL;
+    if (fd < 0)
+        return FAIL;
+
+    if (ftruncate(fd, size) != 0 ||
+            (size > 0 && (*contents = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0)) == MAP_FAILED)) {
+        *contents = NULL;
+        close(fd);
+        return FAIL;
+    }
+    stats_add(STAT_SNAPSHOTS, 1);
+    stats_add(STAT_SNAPSHOT_BYTES, size);
+    return fd;
+}
+
+/*
+ * Unmaps a filled snapshot and seals it. F_SEAL_WRITE can only be added
+ * once no writable mapping is left, and F_SEAL_SEAL keeps anyone from
+ * removing the others.
+ * Input:
+ *  - fd: descriptor of the snapshot, closed if it can't be sealed
+ *  - contents: mapping returned by snapshot_create
+ *  - size: size of the contents
+ * Returns: fd or FAIL
+ */
+int snapshot_seal(int fd, char *contents, long size) {
+    if (contents)
+        munmap(contents, size);
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        close(fd);
+        return FAIL;
+    }
+    return fd;
+}
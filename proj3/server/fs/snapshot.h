@@ -0,0 +1,15 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * Read-only copies of file contents that are handed to clients on the same
+ * host as file descriptors, so that large reads don't go through the
+ * socket (see file_map). A snapshot is a memfd that the server fills
+ * through a mapping of its own and then seals: nobody can write, shrink or
+ * grow it afterwards, so clients can map it and trust what they see.
+ */
+
+int snapshot_create(long size, char **contents);
+int snapshot_seal(int fd, char *contents, long size);
+
+#endif /* SNAPSHOT_H */
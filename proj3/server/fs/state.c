@@ -2,11 +2,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include "state.h"
+#include "stats.h"
+#include "slab.h"
+#include "hugepage.h"
+#include "lockset.h"
+#include "snapshot.h"
 #include "../tecnicofs-api-constants.h"
 
-inode_t inode_table[INODE_TABLE_SIZE];
+/*
+ * Segments are published once and are never moved or freed while the file
+ * system is running, so inumbers and i-node pointers held by other threads
+ * remain valid while the table grows.
+ */
+static InodeSegment *inode_segments[INODE_MAX_SEGMENTS];
+static int inode_count = 0;
+static pthread_mutex_t inode_grow_lock = PTHREAD_MUTEX_INITIALIZER;
+/* held to share or replace the snapshot of a file, see inode_map_file */
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* segments are slices of one region reserved for the whole capacity, so
+ * the table is contiguous and can be backed by huge pages. If the address
+ * space can't be reserved, each segment is allocated on its own. */
+static InodeSegment *inode_region = NULL;
+static int inode_max_segments = INODE_MAX_SEGMENTS;
 
 /*
  * Sleeps for synchronization testing.
@@ -16,18 +38,344 @@ void insert_delay(int cycles) {
 }
 
 /*
- * Initializes the i-nodes table.
+ * Returns the number of i-nodes currently in the table.
  */
-void inode_table_init() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        inode_table[i].nodeType = T_NONE;
-        inode_table[i].data.dirEntries = NULL;
-        inode_table[i].data.fileContents = NULL;
-        if (pthread_rwlock_init(&inode_table[i].rwlock, NULL) != 0) {
-            fprintf(stderr, "Error: failed to initialize lock\n");
-            exit(EXIT_FAILURE);
+int inode_table_size() {
+    return __atomic_load_n(&inode_count, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Return pointers to the parts of the i-th i-node of a segment, wherever
+ * the layout puts them (see state.h).
+ */
+#ifdef INODE_LAYOUT_PACKED
+static inline InodeLock *segment_lock_ref(InodeSegment *segment, int i) {
+    return &segment->inodes[i].lock;
+}
+
+static inline type *segment_type_ref(InodeSegment *segment, int i) {
+    return &segment->inodes[i].nodeType;
+}
+
+static inline InodeData *segment_data_ref(InodeSegment *segment, int i) {
+    return &segment->inodes[i].data;
+}
+#else
+static inline InodeLock *segment_lock_ref(InodeSegment *segment, int i) {
+    return &segment->locks[i];
+}
+
+static inline type *segment_type_ref(InodeSegment *segment, int i) {
+    return &segment->types[i];
+}
+
+static inline InodeData *segment_data_ref(InodeSegment *segment, int i) {
+    return &segment->data[i];
+}
+#endif
+
+/*
+ * Return pointers to the parts of the i-node with the given inumber.
+ * The inumber must be within the table (see inode_table_size).
+ */
+static inline InodeSegment *inode_segment(int inumber) {
+    return __atomic_load_n(&inode_segments[inumber >> INODE_SEGMENT_SHIFT], __ATOMIC_ACQUIRE);
+}
+
+static inline InodeLock *inode_lock_ref(int inumber) {
+    return segment_lock_ref(inode_segment(inumber), inumber & INODE_SEGMENT_MASK);
+}
+
+static inline type *inode_type_ref(int inumber) {
+    return segment_type_ref(inode_segment(inumber), inumber & INODE_SEGMENT_MASK);
+}
+
+static inline InodeData *inode_data_ref(int inumber) {
+    return segment_data_ref(inode_segment(inumber), inumber & INODE_SEGMENT_MASK);
+}
+
+/*
+ * Returns: TRUE if the contents of a file are kept in its i-node, FALSE if
+ * they are in its extent map
+ */
+static int file_is_inline(InodeData *inode_data) {
+    return inode_data->data.fileContents == inode_data->inline_contents;
+}
+
+static void snapshot_mutex_lock() {
+    if (pthread_mutex_lock(&snapshot_lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void snapshot_mutex_unlock() {
+    if (pthread_mutex_unlock(&snapshot_lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Closes the snapshot of a file, whose contents are about to change or
+ * are no longer mapped. Clients that already got a descriptor keep their
+ * copy. Callers exclude file_map, the only one that adds snapshots, so a
+ * file without one is not locked.
+ */
+static void file_drop_snapshot(InodeLock *lock) {
+    if (__atomic_load_n(&lock->snapshot, __ATOMIC_RELAXED) < 0)
+        return;
+
+    snapshot_mutex_lock();
+    if (lock->snapshot >= 0)
+        close(lock->snapshot);
+    lock->snapshot = -1;
+    snapshot_mutex_unlock();
+}
+
+/*
+ * Checks if the inumber is within the table and in use.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: TRUE or FALSE
+ */
+static int inode_in_use(int inumber) {
+    return inumber >= 0 && inumber < inode_table_size() && *inode_type_ref(inumber) != T_NONE;
+}
+
+/*
+ * Adds a new segment to the i-nodes table, unless another thread already
+ * grew it past the size seen by the caller.
+ * Input:
+ *  - seen_size: table size observed by the caller
+ * Returns: SUCCESS or FAIL
+ */
+static int inode_table_grow(int seen_size) {
+    int res = SUCCESS;
+
+    if (pthread_mutex_lock(&inode_grow_lock) != 0) {
+        fprintf(stderr, "Error: failed to lock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int size = inode_count;
+
+    if (size == seen_size) {
+        int seg = size >> INODE_SEGMENT_SHIFT;
+
+        if (seg == inode_max_segments)
+            res = FAIL;
+        else {
+            InodeSegment *segment = inode_region ? &inode_region[seg] : NULL;
+
+            if (!segment && posix_memalign((void**)&segment, 64, sizeof(InodeSegment)) != 0) {
+                fprintf(stderr, "Error: memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+
+            /* only the types are read before an i-node is first allocated,
+             * the rest is initialized then (see inode_init) */
+            for (int i = 0; i < INODE_SEGMENT_SIZE; i++)
+                *segment_type_ref(segment, i) = T_NONE;
+
+            /* publish the segment before making its inumbers visible */
+            __atomic_store_n(&inode_segments[seg], segment, __ATOMIC_RELEASE);
+            __atomic_store_n(&inode_count, size + INODE_SEGMENT_SIZE, __ATOMIC_RELEASE);
         }
     }
+
+    if (pthread_mutex_unlock(&inode_grow_lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock mutex\n");
+        exit(EXIT_FAILURE);
+    }
+    return res;
+}
+
+/*
+ * Free i-node allocator.
+ * Each thread keeps a small cache of free inumbers. Cache misses are served
+ * by a shared lock-free free list (a Treiber stack linked through the
+ * next_free field of the free i-nodes) and, when that is empty, by bumping
+ * inode_next into slots that were never used. Deleted inumbers go back to
+ * the shared list after a grace period (see reclaim.c).
+ */
+
+/* inumber + 1 in the low 32 bits (0 = empty), ABA tag in the high 32 bits */
+static unsigned long inode_free_head = 0;
+static int inode_next = 0;
+
+typedef struct inodeCache {
+    int registered;
+    int count;
+    int inumbers[INODE_CACHE_SIZE];
+} InodeCache;
+
+static __thread InodeCache inode_cache;
+static pthread_key_t inode_cache_key;
+static pthread_once_t inode_cache_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Pushes a free inumber to the shared free list.
+ * Input:
+ *  - inumber: identifier of the free i-node
+ */
+static void free_list_push(int inumber) {
+    unsigned long head = __atomic_load_n(&inode_free_head, __ATOMIC_ACQUIRE), new_head;
+
+    do {
+        __atomic_store_n(&inode_data_ref(inumber)->next_free, (int)(head & 0xffffffff) - 1, __ATOMIC_RELAXED);
+        new_head = ((head >> 32) + 1) << 32 | (unsigned long)(inumber + 1);
+    } while (!__atomic_compare_exchange_n(&inode_free_head, &head, new_head, TRUE,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Pops a free inumber from the shared free list.
+ * Returns:
+ *  inumber: identifier of a free i-node
+ *     FAIL: if the list is empty
+ */
+static int free_list_pop() {
+    unsigned long head = __atomic_load_n(&inode_free_head, __ATOMIC_ACQUIRE), new_head;
+    int inumber;
+
+    do {
+        if ((head & 0xffffffff) == 0)
+            return FAIL;
+        inumber = (int)(head & 0xffffffff) - 1;
+        /* the tag makes the CAS fail if inumber was popped and pushed again meanwhile */
+        int next = __atomic_load_n(&inode_data_ref(inumber)->next_free, __ATOMIC_RELAXED);
+        new_head = ((head >> 32) + 1) << 32 | (unsigned long)(next + 1);
+    } while (!__atomic_compare_exchange_n(&inode_free_head, &head, new_head, TRUE,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return inumber;
+}
+
+/*
+ * Returns the inumbers cached by an exiting thread to the shared list.
+ */
+static void inode_cache_flush(void *arg) {
+    while (inode_cache.count > 0)
+        free_list_push(inode_cache.inumbers[--inode_cache.count]);
+}
+
+static void inode_cache_key_init() {
+    if (pthread_key_create(&inode_cache_key, inode_cache_flush) != 0) {
+        fprintf(stderr, "Error: failed to create thread key\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Makes sure the calling thread's cache is flushed when the thread exits.
+ */
+static void inode_cache_register() {
+    if (inode_cache.registered)
+        return;
+    pthread_once(&inode_cache_once, inode_cache_key_init);
+    pthread_setspecific(inode_cache_key, &inode_cache);
+    inode_cache.registered = TRUE;
+}
+
+/*
+ * Initializes an i-node that was never allocated before.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+static void inode_init(int inumber) {
+    InodeLock *lock = inode_lock_ref(inumber);
+    InodeData *data = inode_data_ref(inumber);
+
+    data->data.fileContents = NULL;
+    data->next_free = FREE_INODE;
+    data->size = 0;
+    data->log = NULL;
+    lock->version = 0;
+    lock->brlock = NULL;
+    lock->reads = lock->writes = 0;
+    lock->opens = 0;
+    lock->ranges = NULL;
+    lock->snapshot = -1;
+    lock->renames = 0;
+    if (rwlock_init(&lock->rwlock) != 0) {
+        fprintf(stderr, "Error: failed to initialize lock\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Gets an inumber that was never used, growing the table if needed.
+ * Returns:
+ *  inumber: identifier of a free i-node
+ *     FAIL: if the table is full
+ */
+static int inode_alloc_new() {
+    int inumber = __atomic_fetch_add(&inode_next, 1, __ATOMIC_RELAXED);
+    if (inumber >= inode_max_segments * INODE_SEGMENT_SIZE || inumber < 0)
+        return FAIL;
+
+    int size;
+    while (inumber >= (size = inode_table_size()))
+        if (inode_table_grow(size) == FAIL)
+            return FAIL;
+
+    inode_init(inumber);
+    return inumber;
+}
+
+/*
+ * Gets a free inumber, growing the table if needed.
+ * Returns:
+ *  inumber: identifier of a free i-node
+ *     FAIL: if the table is full
+ */
+static int inode_alloc() {
+    if (inode_cache.count > 0)
+        return inode_cache.inumbers[--inode_cache.count];
+
+    /* refill the cache with a batch from the shared list */
+    int inumber;
+    while (inode_cache.count < INODE_CACHE_BATCH && (inumber = free_list_pop()) != FAIL)
+        inode_cache.inumbers[inode_cache.count++] = inumber;
+
+    if (inode_cache.count > 0) {
+        inode_cache_register();
+        return inode_cache.inumbers[--inode_cache.count];
+    }
+    return inode_alloc_new();
+}
+
+/*
+ * Returns an inumber to the shared list. Called through reclaim_call, so
+ * that a slot is not reused while optimistic readers may still look at it.
+ * Input:
+ *  - arg: identifier of the freed i-node
+ */
+static void inode_free(void *arg) {
+    free_list_push((int)(long)arg);
+}
+
+/*
+ * Sets the maximum number of i-nodes, must be called before
+ * inode_table_init. Only address space is reserved for them, memory is
+ * taken as the table grows.
+ * Input:
+ *  - capacity: number of i-nodes, rounded up to a whole segment
+ * Returns: SUCCESS, or FAIL if it is not positive or above the maximum
+ */
+int inode_set_capacity(int capacity) {
+    if (capacity <= 0 || capacity > INODE_MAX_SEGMENTS * INODE_SEGMENT_SIZE)
+        return FAIL;
+    inode_max_segments = (capacity + INODE_SEGMENT_SIZE - 1) >> INODE_SEGMENT_SHIFT;
+    return SUCCESS;
+}
+
+/*
+ * Initializes the i-nodes table.
+ */
+void inode_table_init() {
+    inode_region = hugepage_reserve((size_t)inode_max_segments * sizeof(InodeSegment));
+    inode_table_grow(0);
 }
 
 /*
@@ -35,18 +383,45 @@ void inode_table_init() {
  */
 
 void inode_table_destroy() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-            if (inode_table[i].data.dirEntries)
-                    free(inode_table[i].data.dirEntries);
-        }
-        if (pthread_rwlock_destroy(&inode_table[i].rwlock) != 0) {
+    int size = inode_table_size();
+    /* i-nodes past inode_next were never initialized */
+    int used = inode_next < size ? inode_next : size;
+
+    for (int i = 0; i < used; i++) {
+        type nodeType = *inode_type_ref(i);
+        union Data *data = &inode_data_ref(i)->data;
+        InodeLock *lock = inode_lock_ref(i);
+
+        if (nodeType == T_DIRECTORY)
+            directory_destroy(data->dir);
+        else if (nodeType == T_FILE && !file_is_inline(inode_data_ref(i)))
+            extent_truncate(&inode_data_ref(i)->extents, 0);
+        if (nodeType == T_FILE && inode_data_ref(i)->log)
+            applog_destroy(inode_data_ref(i)->log);
+        if (lock->brlock)
+            brlock_destroy(lock->brlock);
+        if (lock->ranges)
+            rangelock_destroy(lock->ranges);
+        if (lock->snapshot >= 0)
+            close(lock->snapshot);
+        if (rwlock_destroy(&lock->rwlock) != 0) {
             fprintf(stderr, "Error: failed to destroy rwlock\n");
             exit(EXIT_FAILURE);
         }
     }
+
+    for (int seg = 0; seg < (size >> INODE_SEGMENT_SHIFT); seg++) {
+        if (!inode_region)
+            free(inode_segments[seg]);
+        inode_segments[seg] = NULL;
+    }
+    if (inode_region)
+        hugepage_release(inode_region, (size_t)inode_max_segments * sizeof(InodeSegment));
+    inode_region = NULL;
+    inode_count = 0;
+    inode_next = 0;
+    inode_free_head = 0;
+    inode_cache.count = 0;
 }
 
 /*
@@ -61,36 +436,42 @@ int inode_create(type nType) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if (pthread_rwlock_trywrlock(&inode_table[inumber].rwlock) == 0) {
-            if (inode_table[inumber].nodeType == T_NONE) {
-                inode_table[inumber].nodeType = nType;
-
-                if (nType == T_DIRECTORY) {
-                    /* Initializes entry table */
-                    inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
-
-                    if (!inode_table[inumber].data.dirEntries) {
-                        fprintf(stderr, "Error: memory allocation failed\n");
-                        return ABORT;
-                    }
-                    
-                    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-                        inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-
-                }
-                else {
-                    inode_table[inumber].data.fileContents = NULL;
-                }
-                return inumber;
-            }
-            if (pthread_rwlock_unlock(&inode_table[inumber].rwlock) != 0) {
-                fprintf(stderr, "Error: failed to unlock rwlock\n");
-                return ABORT;
-            }
+    int inumber, skipped[INODE_CREATE_SKIPS], nskipped = 0;
+
+    /* a reused slot may still be locked by a walker that found it before
+     * it was deleted; the caller holds the parent, so waiting here would
+     * lock out of inumber order (see lockset_lock). Busy slots are put
+     * back and, after a few, one that nobody can hold is taken instead. */
+    while ((inumber = nskipped < INODE_CREATE_SKIPS ? inode_alloc() : inode_alloc_new()) != FAIL &&
+           inode_trywrlock(inumber) != SUCCESS) {
+        /* a slot that was never used can only fail to lock on an error */
+        if (nskipped == INODE_CREATE_SKIPS) {
+            inumber = ABORT;
+            break;
         }
+        skipped[nskipped++] = inumber;
+    }
+
+    while (nskipped > 0)
+        free_list_push(skipped[--nskipped]);
+    if (inumber < 0)
+        return inumber;
+
+    union Data *data = &inode_data_ref(inumber)->data;
+
+    if (nType == T_DIRECTORY) {
+        /* Initializes entry table */
+        __atomic_store_n(&data->dir, directory_create(), __ATOMIC_RELEASE);
+    }
+    else {
+        data->fileContents = NULL;
+        inode_data_ref(inumber)->size = 0;
+        inode_data_ref(inumber)->log = NULL;
+        inode_data_ref(inumber)->extents.root = NULL;
+        inode_data_ref(inumber)->extents.levels = 0;
     }
-    return FAIL;
+    __atomic_store_n(inode_type_ref(inumber), nType, __ATOMIC_RELEASE);
+    return inumber;
 }
 
 /*
@@ -103,15 +484,37 @@ int inode_delete(int inumber) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_in_use(inumber)) {
         printf("inode_delete: invalid inumber\n");
         return FAIL;
     } 
 
-    inode_table[inumber].nodeType = T_NONE;
-    /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
+    type *nodeType = inode_type_ref(inumber);
+    InodeData *inode_data = inode_data_ref(inumber);
+    union Data *data = &inode_data->data;
+
+    /* optimistic readers may still be looking at the old entries, but file
+     * contents are only read under the lock, which is held */
+    if (*nodeType == T_DIRECTORY)
+        directory_destroy(data->dir);
+    else if (!file_is_inline(inode_data))
+        extent_truncate(&inode_data->extents, 0);
+    if (*nodeType == T_FILE && inode_data->log) {
+        applog_destroy(inode_data->log);
+        inode_data->log = NULL;
+    }
+
+    /* the file isn't open, so nobody holds a range or maps it */
+    if (inode_lock_ref(inumber)->ranges) {
+        rangelock_destroy(inode_lock_ref(inumber)->ranges);
+        inode_lock_ref(inumber)->ranges = NULL;
+    }
+    file_drop_snapshot(inode_lock_ref(inumber));
+
+    __atomic_store_n(nodeType, T_NONE, __ATOMIC_RELEASE);
+    __atomic_store_n(&data->fileContents, NULL, __ATOMIC_RELEASE);
+
+    reclaim_call(inode_free, (void*)(long)inumber);
 
     return SUCCESS;
 }
@@ -129,57 +532,804 @@ int inode_get(int inumber, type *nType, union Data *data) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_in_use(inumber)) {
         printf("inode_get: invalid inumber %d\n", inumber);
         return FAIL;
     }
 
     if (nType)
-        *nType = inode_table[inumber].nodeType;
+        *nType = *inode_type_ref(inumber);
 
     if (data)
-        *data = inode_table[inumber].data;
+        *data = inode_data_ref(inumber)->data;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Copies the contents of the i-node without holding its lock, for
+ * optimistic readers: the result is only meaningful if the i-node version
+ * is validated afterwards (see inode_read_validate).
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - nType: pointer to type
+ *  - data: pointer to data
+ * Returns: SUCCESS or FAIL
+ */
+int inode_peek(int inumber, type *nType, union Data *data) {
+    /* Used for testing synchronization speedup */
+    insert_delay(DELAY);
+
+    if (inumber < 0 || inumber >= inode_table_size())
+        return FAIL;
+
+    *nType = __atomic_load_n(inode_type_ref(inumber), __ATOMIC_ACQUIRE);
+    data->dir = __atomic_load_n(&inode_data_ref(inumber)->data.dir, __ATOMIC_ACQUIRE);
+
+    /* a delete may have cleared the contents after the type was read */
+    if (*nType == T_DIRECTORY && !data->dir)
+        return FAIL;
+    return *nType == T_NONE ? FAIL : SUCCESS;
+}
+
+/*
+ * I-node locks.
+ * Every i-node starts with an rwlock (see rwlock.h). Read-hot directories (and the
+ * root) switch to a big-reader lock, so that their readers don't all
+ * write the same cache line. The switch is done while holding the rwlock
+ * as a writer, and whoever acquires the rwlock afterwards sees the brlock,
+ * releases the rwlock and takes the brlock instead, so the rwlock is never
+ * held again once brlock is set.
+ */
+
+static int brlock_enabled = TRUE;
+static int locking = TRUE;
+
+/*
+ * Chooses whether the lock functions below lock at all. They don't when a
+ * global lock already serializes the operations (see sync.h). Must be set
+ * before the file system is initialized.
+ */
+void inode_set_locking(int enabled) {
+    locking = enabled;
+}
+
+/*
+ * Chooses whether read-hot i-nodes switch to big-reader locks. Must be set
+ * before the file system is initialized.
+ */
+void inode_set_brlock_enabled(int enabled) {
+    brlock_enabled = enabled;
+}
+
+/*
+ * Switches an i-node to a big-reader lock. The calling thread must not hold
+ * the i-node's lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+void inode_use_brlock(int inumber) {
+    InodeLock *inode = inode_lock_ref(inumber);
+
+    if (!brlock_enabled || __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE))
+        return;
+
+    BrLock *brlock = brlock_create();
+
+    if (rwlock_wrlock(&inode->rwlock) != 0) {
+        fprintf(stderr, "Error: failed to lock\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!inode->brlock) {
+        __atomic_store_n(&inode->brlock, brlock, __ATOMIC_RELEASE);
+        stats_add(STAT_BRLOCK_SWITCHES, 1);
+    }
+    else
+        brlock_destroy(brlock);
+    if (rwlock_unlock(&inode->rwlock) != 0) {
+        fprintf(stderr, "Error: failed to unlock\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Counts a read lock on the rwlock, switching to a brlock when the i-node
+ * becomes read-hot.
+ */
+static void inode_count_read(int inumber) {
+    InodeLock *inode = inode_lock_ref(inumber);
+
+    if (brlock_enabled &&
+        __atomic_add_fetch(&inode->reads, 1, __ATOMIC_RELAXED) % BRLOCK_HOT_READS == 0 &&
+        __atomic_load_n(&inode->writes, __ATOMIC_RELAXED) * BRLOCK_READ_RATIO < inode->reads)
+        inode_use_brlock(inumber);
+}
+
+/*
+ * Read locks the i-node.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS or FAIL
+ */
+int inode_rdlock(int inumber) {
+    if (!locking)
+        return SUCCESS;
+
+    InodeLock *inode = inode_lock_ref(inumber);
+    BrLock *brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE);
+
+    if (!brlock) {
+        inode_count_read(inumber);
+        if (rwlock_rdlock(&inode->rwlock) != 0) {
+            fprintf(stderr, "Error: failed to lock\n");
+            return FAIL;
+        }
+        if (!(brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE)))
+            return SUCCESS;
+        /* switched while we waited */
+        rwlock_unlock(&inode->rwlock);
+    }
+    brlock_rdlock(brlock);
+    return SUCCESS;
+}
+
+/*
+ * Makes the version odd after the i-node is write locked, so that
+ * optimistic readers know it may be changing.
+ */
+static void inode_write_begin(InodeLock *inode) {
+    __atomic_store_n(&inode->version, inode->version + 1, __ATOMIC_RELAXED);
+    /* the odd version must be visible before any change to the i-node */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Write locks the i-node, making its version odd until it is unlocked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS or FAIL
+ */
+int inode_wrlock(int inumber) {
+    if (!locking)
+        return SUCCESS;
+
+    InodeLock *inode = inode_lock_ref(inumber);
+    BrLock *brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE);
+
+    if (!brlock) {
+        if (rwlock_wrlock(&inode->rwlock) != 0) {
+            fprintf(stderr, "Error: failed to lock\n");
+            return FAIL;
+        }
+        if (!(brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE))) {
+            __atomic_store_n(&inode->writes, inode->writes + 1, __ATOMIC_RELAXED);
+            inode_write_begin(inode);
+            return SUCCESS;
+        }
+        rwlock_unlock(&inode->rwlock);
+    }
+    brlock_wrlock(brlock);
+    inode_write_begin(inode);
+    return SUCCESS;
+}
+
+/*
+ * Read locks the i-node if no writer holds it.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS, or FAIL if the lock is busy
+ */
+int inode_tryrdlock(int inumber) {
+    if (!locking)
+        return SUCCESS;
+
+    InodeLock *inode = inode_lock_ref(inumber);
+    BrLock *brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE);
+
+    if (!brlock) {
+        int err = rwlock_tryrdlock(&inode->rwlock);
+
+        if (err != 0) {
+            if (err != EBUSY)
+                fprintf(stderr, "Error: failed to lock\n");
+            return FAIL;
+        }
+        if (!(brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE)))
+            return SUCCESS;
+        rwlock_unlock(&inode->rwlock);
+    }
+    return brlock_tryrdlock(brlock);
+}
+
+/*
+ * Write locks the i-node if nobody holds it, see inode_wrlock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS, or FAIL if the lock is busy
+ */
+int inode_trywrlock(int inumber) {
+    if (!locking)
+        return SUCCESS;
+
+    InodeLock *inode = inode_lock_ref(inumber);
+    BrLock *brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE);
+
+    if (!brlock) {
+        int err = rwlock_trywrlock(&inode->rwlock);
+
+        if (err != 0) {
+            if (err != EBUSY)
+                fprintf(stderr, "Error: failed to lock\n");
+            return FAIL;
+        }
+        if (!(brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE))) {
+            __atomic_store_n(&inode->writes, inode->writes + 1, __ATOMIC_RELAXED);
+            inode_write_begin(inode);
+            return SUCCESS;
+        }
+        rwlock_unlock(&inode->rwlock);
+    }
+    if (brlock_trywrlock(brlock) != SUCCESS)
+        return FAIL;
+    inode_write_begin(inode);
+    return SUCCESS;
+}
+
+/*
+ * Unlocks the i-node, whether read or write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS or FAIL
+ */
+int inode_unlock(int inumber) {
+    if (!locking)
+        return SUCCESS;
+
+    InodeLock *inode = inode_lock_ref(inumber);
+    BrLock *brlock = __atomic_load_n(&inode->brlock, __ATOMIC_ACQUIRE);
+    /* only a writer can see an odd version while holding the lock */
+    int writer = inode->version & 1;
+
+    if (writer)
+        __atomic_store_n(&inode->version, inode->version + 1, __ATOMIC_RELEASE);
+
+    if (brlock) {
+        if (writer)
+            brlock_wrunlock(brlock);
+        else
+            brlock_rdunlock(brlock);
+    }
+    else if (rwlock_unlock(&inode->rwlock) != 0) {
+        fprintf(stderr, "Error: failed to unlock\n");
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Starts an optimistic read of an i-node.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: the i-node version, odd if it is write locked
+ */
+unsigned int inode_read_begin(int inumber) {
+    return __atomic_load_n(&inode_lock_ref(inumber)->version, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Checks that an i-node didn't change since inode_read_begin.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - version: value returned by inode_read_begin
+ * Returns: TRUE or FALSE
+ */
+int inode_read_validate(int inumber, unsigned int version) {
+    /* the reads being validated must not move past the version check */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(version & 1) && __atomic_load_n(&inode_lock_ref(inumber)->version, __ATOMIC_RELAXED) == version;
+}
+
+/*
+ * Moves the contents of a file from its i-node to an extent map. Those of
+ * a file with a log end where the log starts.
+ */
+static void file_spill(InodeData *inode_data) {
+    char contents[INODE_INLINE_SIZE];
+    long len = inode_data->log ? inode_data->log->base : inode_data->size;
+
+    memcpy(contents, inode_data->inline_contents, len);
+    inode_data->extents.root = NULL;
+    inode_data->extents.levels = 0;
+    __atomic_store_n(&inode_data->data.fileContents, NULL, __ATOMIC_RELEASE);
+    extent_write(&inode_data->extents, contents, len, 0);
+}
+
+/*
+ * Copies part of a file, from its contents and, past where its log starts,
+ * from its log. The bytes must be below the size of the file.
+ */
+static void file_read(InodeData *inode_data, char *buffer, long len, long offset) {
+    AppendLog *log = inode_data->log;
+    long end = log && log->base < offset + len ? log->base : offset + len;
+    long n = end > offset ? end - offset : 0;
+
+    if (n > 0 && file_is_inline(inode_data))
+        memcpy(buffer, inode_data->inline_contents + offset, n);
+    else if (n > 0)
+        extent_read(&inode_data->extents, buffer, n, offset);
+    if (n < len)
+        applog_read(log, buffer + n, len - n, offset + n);
+}
+
+/*
+ * Folds the log of a file into its contents up to end.
+ * The i-node must be write locked.
+ */
+static void file_fold_log(InodeData *inode_data, long end) {
+    if (!inode_data->log || end <= inode_data->log->base)
+        return;
+    if (file_is_inline(inode_data))
+        file_spill(inode_data);
+    applog_fold(inode_data->log, &inode_data->extents, end);
+}
+
+/*
+ * Folds all of the log of a file before a change other than an append,
+ * see file_rebase_log.
+ */
+static void file_flush_log(InodeData *inode_data) {
+    file_fold_log(inode_data, inode_data->size);
+}
+
+/*
+ * Starts the empty log of a file over at its size, after a change other
+ * than an append.
+ */
+static void file_rebase_log(InodeData *inode_data) {
+    if (inode_data->log)
+        applog_rebase(inode_data->log, inode_data->size);
+}
+
+/*
+ * Grows the size of a file to end, if it is smaller. Writers of disjoint
+ * ranges may extend the file at the same time (see inode_write_file_shared).
+ */
+static void file_extend(InodeData *inode_data, long end) {
+    int size = __atomic_load_n(&inode_data->size, __ATOMIC_RELAXED);
+
+    while (end > size && !__atomic_compare_exchange_n(&inode_data->size, &size, (int)end, FALSE,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * Writes part of a file, see inode_write_file.
+ */
+static void file_write(InodeData *inode_data, char *buffer, long len, long offset) {
+    long end = offset + len;
+
+    /* an empty file has no blocks, small contents can move back inline */
+    if (!file_is_inline(inode_data) && inode_data->size == 0 && end <= INODE_INLINE_SIZE) {
+        memset(inode_data->inline_contents, 0, INODE_INLINE_SIZE);
+        __atomic_store_n(&inode_data->data.fileContents, inode_data->inline_contents, __ATOMIC_RELEASE);
+    }
+    else if (file_is_inline(inode_data) && end > INODE_INLINE_SIZE)
+        file_spill(inode_data);
+
+    if (file_is_inline(inode_data))
+        memcpy(inode_data->inline_contents + offset, buffer, len);
+    else
+        extent_write(&inode_data->extents, buffer, len, offset);
+
+    file_extend(inode_data, end);
+}
+
+/*
+ * Changes the size of a file, see inode_truncate_file.
+ */
+static void file_truncate(InodeData *inode_data, long size) {
+    if (file_is_inline(inode_data) && size > INODE_INLINE_SIZE)
+        file_spill(inode_data);
+
+    /* bytes past the end are kept zeroed, so that growing reads zeros */
+    if (file_is_inline(inode_data) && size < inode_data->size)
+        memset(inode_data->inline_contents + size, 0, inode_data->size - size);
+    else if (!file_is_inline(inode_data) && size < inode_data->size)
+        extent_truncate(&inode_data->extents, size);
+
+    inode_data->size = size;
+}
+
+/*
+ * Replaces the contents of a file. Contents that fit in INODE_INLINE_SIZE
+ * are kept in the i-node itself, larger ones in extents.
+ * The i-node must be write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - fileContents: new contents
+ *  - len: length of the contents
+ * Returns: SUCCESS or FAIL
+ */
+int inode_set_file(int inumber, char *fileContents, int len) {
+    /* Used for testing synchronization speedup */
+    insert_delay(DELAY);
+
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE || len < 0) {
+        printf("inode_set_file: invalid inumber\n");
+        return FAIL;
+    }
+
+    InodeData *inode_data = inode_data_ref(inumber);
+
+    file_drop_snapshot(inode_lock_ref(inumber));
+    file_flush_log(inode_data);
+    file_truncate(inode_data, 0);
+    file_write(inode_data, fileContents, len, 0);
+    file_rebase_log(inode_data);
+    return SUCCESS;
+}
+
+/*
+ * Copies part of the contents of a file, holes read as zeros.
+ * The i-node must be locked, and the range read locked unless the i-node
+ * is write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - buffer: receives the contents
+ *  - len: maximum number of bytes to copy
+ *  - offset: where to start in the file
+ * Returns: the number of bytes copied, 0 past the end, or FAIL
+ */
+int inode_read_file(int inumber, char *buffer, int len, long offset) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE || len < 0 || offset < 0) {
+        printf("inode_read_file: invalid inumber\n");
+        return FAIL;
+    }
+
+    InodeData *inode_data = inode_data_ref(inumber);
+    /* appends past it may still be copying their data */
+    int size = __atomic_load_n(&inode_data->size, __ATOMIC_ACQUIRE);
+
+    if (offset >= size)
+        return 0;
+    if (len > size - offset)
+        len = size - offset;
+
+    file_read(inode_data, buffer, len, offset);
+    return len;
+}
+
+/*
+ * Writes part of a file, extending it if the write ends past its size. A
+ * gap between the old size and offset is a hole that reads as zeros. Only
+ * the blocks the write covers are touched, so appends are O(1).
+ * The i-node must be write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - buffer: data to write
+ *  - len: number of bytes to write
+ *  - offset: where to start in the file
+ * Returns: the number of bytes written or FAIL
+ */
+int inode_write_file(int inumber, char *buffer, int len, long offset) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE || len < 0 || offset < 0 ||
+            offset + len > INT_MAX) {
+        printf("inode_write_file: invalid write\n");
+        return FAIL;
+    }
+
+    if (len > 0) {
+        InodeData *inode_data = inode_data_ref(inumber);
+
+        file_drop_snapshot(inode_lock_ref(inumber));
+        file_flush_log(inode_data);
+        file_write(inode_data, buffer, len, offset);
+        file_rebase_log(inode_data);
+    }
+    return len;
+}
+
+/*
+ * Writes part of a file without excluding the writers of other ranges. It
+ * only does writes that keep the contents in extents and don't have to add
+ * index levels (see extent_write), the others must be done with
+ * inode_write_file.
+ * The i-node must be read locked and the range write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - buffer: data to write
+ *  - len: number of bytes to write
+ *  - offset: where to start in the file
+ * Returns: the number of bytes written, FAIL, or RETRY if the i-node must
+ * be write locked for this write
+ */
+int inode_write_file_shared(int inumber, char *buffer, int len, long offset) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE || len < 0 || offset < 0 ||
+            offset + len > INT_MAX) {
+        printf("inode_write_file_shared: invalid write\n");
+        return FAIL;
+    }
+
+    InodeData *inode_data = inode_data_ref(inumber);
+
+    if (len == 0)
+        return 0;
+    /* an empty file may still move its contents inline, and appends take
+     * their offsets from a log that must start at the size of the file */
+    if (file_is_inline(inode_data) || __atomic_load_n(&inode_data->size, __ATOMIC_RELAXED) == 0 ||
+            !extent_covers(&inode_data->extents, offset + len) || inode_data->log)
+        return RETRY;
+
+    /* file_map locks every range, so no snapshot is being made */
+    file_drop_snapshot(inode_lock_ref(inumber));
+    extent_write(&inode_data->extents, buffer, len, offset);
+    file_extend(inode_data, offset + len);
+    return len;
+}
+
+/*
+ * Changes the size of a file. Shrinking frees the blocks past the new size,
+ * growing leaves a hole.
+ * The i-node must be write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - size: new size
+ * Returns: SUCCESS or FAIL
+ */
+int inode_truncate_file(int inumber, long size) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE || size < 0 || size > INT_MAX) {
+        printf("inode_truncate_file: invalid size\n");
+        return FAIL;
+    }
+
+    InodeData *inode_data = inode_data_ref(inumber);
+
+    file_drop_snapshot(inode_lock_ref(inumber));
+    file_flush_log(inode_data);
+    file_truncate(inode_data, size);
+    file_rebase_log(inode_data);
+    return SUCCESS;
+}
+
+/*
+ * Gets a sealed snapshot of the contents of a file, see snapshot.h. It is
+ * made by the first map after the file changes, and handed to the maps
+ * that follow until a write, a truncate or the last close drops it. Appends
+ * don't exclude maps, so a snapshot is only shared while the file keeps
+ * the size it was made at.
+ * The i-node must be locked, and every range of the file read locked
+ * unless the i-node is write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - fd: receives a new descriptor of the snapshot, to be closed by the
+ *    caller
+ * Returns: the size of the file or FAIL
+ */
+int inode_map_file(int inumber, int *fd) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE) {
+        printf("inode_map_file: invalid inumber\n");
+        return FAIL;
+    }
+
+    InodeLock *lock = inode_lock_ref(inumber);
+    InodeData *inode_data = inode_data_ref(inumber);
+    int size = __atomic_load_n(&inode_data->size, __ATOMIC_ACQUIRE);
+    char *contents;
+    int snapshot;
+
+    /* other maps may hold the read locks too */
+    snapshot_mutex_lock();
+    if (lock->snapshot >= 0 && lock->snapshot_size == size) {
+        *fd = dup(lock->snapshot);
+        snapshot_mutex_unlock();
+        stats_add(STAT_SNAPSHOT_SHARED, 1);
+        return *fd < 0 ? FAIL : size;
+    }
+    snapshot_mutex_unlock();
+
+    if ((snapshot = snapshot_create(size, &contents)) == FAIL)
+        return FAIL;
+    if (contents)
+        file_read(inode_data, contents, size, 0);
+    if ((snapshot = snapshot_seal(snapshot, contents, size)) == FAIL)
+        return FAIL;
+
+    snapshot_mutex_lock();
+    if (lock->snapshot >= 0)
+        close(lock->snapshot);
+    lock->snapshot = snapshot;
+    lock->snapshot_size = size;
+    *fd = dup(snapshot);
+    snapshot_mutex_unlock();
+    return *fd < 0 ? FAIL : size;
+}
+
+/*
+ * Adds a log to a file, for the descriptors opened to append to it.
+ * The i-node must be write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS, or FAIL if it is not a file
+ */
+int inode_start_log(int inumber) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE) {
+        printf("inode_start_log: invalid inumber\n");
+        return FAIL;
+    }
+
+    InodeData *inode_data = inode_data_ref(inumber);
+
+    if (!inode_data->log)
+        inode_data->log = applog_create(inode_data->size);
+    return SUCCESS;
+}
+
+/*
+ * Appends to a file through its log (see applog.h). The offset is taken
+ * with a single fetch-and-add, so concurrent appends never overlap, and
+ * the data is copied into blocks nobody else writes.
+ * The i-node must be read locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - buffer: data to append
+ *  - len: number of bytes to append
+ *  - offset: receives where the data was appended
+ *  - compact: receives TRUE if the file must be queued for the compactor
+ * Returns: the number of bytes written, FAIL, or RETRY if the file has no
+ * log yet (see inode_start_log)
+ */
+int inode_append_file(int inumber, char *buffer, int len, long *offset, int *compact) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE || len < 0) {
+        printf("inode_append_file: invalid append\n");
+        return FAIL;
+    }
+
+    InodeData *inode_data = inode_data_ref(inumber);
+    AppendLog *log = inode_data->log;
+
+    *compact = FALSE;
+    if (!log)
+        return RETRY;
+    if (len == 0) {
+        *offset = __atomic_load_n(&inode_data->size, __ATOMIC_ACQUIRE);
+        return 0;
+    }
+
+    long start = applog_reserve(log, len);
+
+    /* the appends after it start even further, and fail too */
+    if ((*offset = start) + len > INT_MAX) {
+        printf("inode_append_file: file too large\n");
+        return FAIL;
+    }
 
+    applog_write(log, buffer, len, start);
+    applog_commit(&inode_data->size, start, start + len);
+
+    if (start / APPLOG_FOLD_SIZE != (start + len) / APPLOG_FOLD_SIZE)
+        *compact = !__atomic_exchange_n(&log->queued, TRUE, __ATOMIC_RELAXED);
+    return len;
+}
+
+/*
+ * Folds the full blocks of the log of a file into its extents, without
+ * copying them. The rest stays in the log until the next append fills it.
+ * The inumber may have been reused, or be free, since the file was queued.
+ * The i-node must be write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS, or FAIL if it is no longer a file with a log
+ */
+int inode_compact_file(int inumber) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE || !inode_data_ref(inumber)->log)
+        return FAIL;
+
+    InodeData *inode_data = inode_data_ref(inumber);
+
+    inode_data->log->queued = FALSE;
+    file_fold_log(inode_data, inode_data->size & ~(long)(EXTENT_BLOCK_SIZE - 1));
     return SUCCESS;
 }
 
+/*
+ * Counts a new descriptor open on a file, adding its byte-range lock if it
+ * has none.
+ * The i-node must be locked, see inode_open_count.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: SUCCESS, or FAIL if it is not a file
+ */
+int inode_open(int inumber) {
+    if (!inode_in_use(inumber) || *inode_type_ref(inumber) != T_FILE)
+        return FAIL;
+
+    InodeLock *lock = inode_lock_ref(inumber);
+    RangeLock *ranges = NULL;
+
+    /* other opens may hold the read lock too */
+    if (!__atomic_load_n(&lock->ranges, __ATOMIC_ACQUIRE)) {
+        RangeLock *created = rangelock_create();
+
+        if (!__atomic_compare_exchange_n(&lock->ranges, &ranges, created, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            rangelock_destroy(created);
+    }
+    __atomic_add_fetch(&lock->opens, 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+/*
+ * Counts a descriptor closed on a file. The last one drops its snapshot and
+ * folds and frees its log.
+ * The i-node must be write locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+void inode_close(int inumber) {
+    InodeData *inode_data = inode_data_ref(inumber);
+
+    if (__atomic_sub_fetch(&inode_lock_ref(inumber)->opens, 1, __ATOMIC_RELAXED) > 0)
+        return;
+
+    file_drop_snapshot(inode_lock_ref(inumber));
+    if (inode_data->log) {
+        file_flush_log(inode_data);
+        applog_destroy(inode_data->log);
+        inode_data->log = NULL;
+    }
+}
+
+/*
+ * Returns: the number of descriptors open on a file. Opens hold at least a
+ * read lock on the i-node, so the count can't grow while it is write locked.
+ */
+int inode_open_count(int inumber) {
+    return __atomic_load_n(&inode_lock_ref(inumber)->opens, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns: the byte-range lock of an open file
+ */
+RangeLock *inode_ranges(int inumber) {
+    return __atomic_load_n(&inode_lock_ref(inumber)->ranges, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Returns: the rename sequence of a directory, see move_aux. It is kept
+ * when the i-node is reused, so it never goes back.
+ */
+unsigned long *inode_renames(int inumber) {
+    return &inode_lock_ref(inumber)->renames;
+}
 
 /*
  * Resets an entry for a directory.
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
  * Returns: SUCCESS or FAIL
  */
-int dir_reset_entry(int inumber, int sub_inumber) {
+int dir_reset_entry(int inumber, int sub_inumber, char *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_in_use(inumber)) {
         printf("inode_reset_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (*inode_type_ref(inumber) != T_DIRECTORY) {
         printf("inode_reset_entry: can only reset entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < FREE_INODE) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_in_use(sub_inumber)) {
         printf("inode_reset_entry: invalid entry inumber\n");
         return FAIL;
     }
 
-    
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == sub_inumber) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-            inode_table[inumber].data.dirEntries[i].name[0] = '\0';
-            return SUCCESS;
-        }
-    }
 
-    return FAIL;
+    return directory_remove(inode_data_ref(inumber)->data.dir, sub_name, sub_inumber);
 }
 
 
@@ -195,17 +1345,17 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_in_use(inumber)) {
         printf("inode_add_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (*inode_type_ref(inumber) != T_DIRECTORY) {
         printf("inode_add_entry: can only add entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < 0) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_in_use(sub_inumber)) {
         printf("inode_add_entry: invalid entry inumber\n");
         return FAIL;
     }
@@ -215,16 +1365,8 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
                entry name must be non-empty\n");
         return FAIL;
     }
-    
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == FREE_INODE) {
-            inode_table[inumber].data.dirEntries[i].inumber = sub_inumber;
-            strcpy(inode_table[inumber].data.dirEntries[i].name, sub_name);
-            return SUCCESS;
-        }
-    }
 
-    return FAIL;
+    return directory_insert(inode_data_ref(inumber)->data.dir, sub_name, sub_inumber);
 }
 
 
@@ -235,21 +1377,27 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
  *  - name: pointer to the name of current file/dir
  */
 void inode_print_tree(FILE *fp, int inumber, char *name) {
-    if (inode_table[inumber].nodeType == T_FILE) {
+    type nodeType = *inode_type_ref(inumber);
+
+    if (nodeType == T_FILE) {
         fprintf(fp, "%s\n", name);
         return;
     }
 
-    if (inode_table[inumber].nodeType == T_DIRECTORY) {
+    if (nodeType == T_DIRECTORY) {
+        DirIterator it;
+        DirEntry *entry;
+
         fprintf(fp, "%s\n", name);
-        for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-            if (inode_table[inumber].data.dirEntries[i].inumber != FREE_INODE) {
-                char path[MAX_FILE_NAME];
-                if (snprintf(path, sizeof(path), "%s/%s", name, inode_table[inumber].data.dirEntries[i].name) > sizeof(path)) {
-                    fprintf(stderr, "truncation when building full path\n");
-                }
-                inode_print_tree(fp, inode_table[inumber].data.dirEntries[i].inumber, path);
-            }
+        directory_iter_init(&it, inode_data_ref(inumber)->data.dir);
+        while ((entry = directory_iter_next(&it))) {
+            /* released before the next entry, after the subtree is done */
+            ArenaMark mark = arena_mark();
+            char *path = arena_alloc(strlen(name) + entry->len + 2);
+
+            sprintf(path, "%s/%s", name, entry->name);
+            inode_print_tree(fp, entry->inumber, path);
+            arena_release(mark);
         }
     }
 }
@@ -5,55 +5,160 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include "../tecnicofs-api-constants.h"
+#include "directory.h"
+#include "reclaim.h"
+#include "brlock.h"
+#include "rwlock.h"
+#include "extent.h"
+#include "rangelock.h"
+#include "applog.h"
 
 /* FS root inode number */
 #define FS_ROOT 0
 
 #define FREE_INODE -1
-#define INODE_TABLE_SIZE 50
-#define MAX_DIR_ENTRIES 20
+
+/* 
+ * The i-node table is split in segments of INODE_SEGMENT_SIZE i-nodes that
+ * are added on demand, up to INODE_MAX_SEGMENTS (64M i-nodes in total) or
+ * the capacity set with inode_set_capacity
+ */
+#define INODE_SEGMENT_SHIFT 10
+#define INODE_SEGMENT_SIZE (1 << INODE_SEGMENT_SHIFT)
+#define INODE_SEGMENT_MASK (INODE_SEGMENT_SIZE - 1)
+#define INODE_MAX_SEGMENTS (1 << 16)
+
+/* free inumbers kept by each thread and moved from the shared list at once */
+#define INODE_CACHE_SIZE 64
+#define INODE_CACHE_BATCH 32
+
+/* reused inumbers a create skips because their lock is still held, before
+ * it takes one that was never used */
+#define INODE_CREATE_SKIPS 8
+
+/* file contents up to this size live in the i-node, larger ones in extents */
+#define INODE_INLINE_SIZE 48
+
+/* read locks after which a directory that is rarely written switches to a
+ * big-reader lock, at least BRLOCK_READ_RATIO reads per write */
+#define BRLOCK_HOT_READS 4096
+#define BRLOCK_READ_RATIO 64
+
+#define FALSE 0
+#define TRUE 1
 
 #define SUCCESS 0
 #define FAIL -1
 #define ABORT -2
 
+#ifndef DELAY
 #define DELAY 5000000
+#endif
 
 
 /*
- * Contains the name of the entry and respective i-number
- */
-typedef struct dirEntry {
-	char name[MAX_FILE_NAME];
-	int inumber;
-} DirEntry;
-
-/*
- * Data is either text (file) or entries (DirEntry)
+ * Data is either text (file) or entries (Directory)
  */
 union Data {
-	char *fileContents; /* for files */
-	DirEntry *dirEntries; /* for directories */
+	char *fileContents; /* for files kept inline, NULL for files in extents */
+	Directory *dir; /* for directories */
 };
 
 /*
- * I-node definition
+ * I-node definition, split by how the fields are accessed. Each segment of
+ * the table keeps one array of each part (see InodeSegment), so that:
+ *  - lock words written by one thread never share a cache line with the
+ *    lock words of the neighbouring i-nodes
+ *  - the types checked on every walk and scan are packed 16 to a line
+ *  - the contents, only needed once an i-node is found, stay out of both
+ * Building with INODE_LAYOUT_PACKED brings back the layout this replaced,
+ * one array of whole i-nodes with unpadded locks, for the layout benchmark
+ * to compare against (see bench_packed in the Makefile).
  */
-typedef struct inode_t {    
-	type nodeType;
+#ifdef INODE_LAYOUT_PACKED
+#define INODE_LOCK_ALIGN
+#else
+#define INODE_LOCK_ALIGN __attribute__((aligned(64)))
+#endif
+
+typedef struct inodeLock {
+    RwLock rwlock; /* see rwlock.h */
+    unsigned int version; /* odd while write locked, see inode_read_begin */
+    BrLock *brlock; /* replaces rwlock once the i-node is read-hot */
+    unsigned int reads, writes; /* locks taken on rwlock, to detect that */
+    int opens; /* descriptors open on the file, it can't be deleted meanwhile */
+    RangeLock *ranges; /* byte-range lock of the file, added by its first open */
+    int snapshot; /* sealed copy of the contents for file_map, -1 if none */
+    int snapshot_size; /* size of the file when it was made */
+    unsigned long renames; /* moves validated below the directory, see move_aux */
+} INODE_LOCK_ALIGN InodeLock;
+
+typedef struct inodeData {
 	union Data data;
-    pthread_rwlock_t rwlock;
-} inode_t;
+    int next_free; /* next free i-node while in the free list */
+    int size; /* of the file contents */
+    AppendLog *log; /* of a file opened for appending, NULL otherwise */
+    union {
+        /* small file contents, data.fileContents points here when they fit */
+        char inline_contents[INODE_INLINE_SIZE];
+        /* blocks of the larger ones, see extent.h */
+        ExtentMap extents;
+    };
+} InodeData;
+
+#ifdef INODE_LAYOUT_PACKED
+typedef struct inodePacked {
+    type nodeType;
+    InodeLock lock;
+    InodeData data;
+} InodePacked;
+
+typedef struct inodeSegment {
+    InodePacked inodes[INODE_SEGMENT_SIZE];
+} InodeSegment;
+#else
+typedef struct inodeSegment {
+    InodeLock locks[INODE_SEGMENT_SIZE];
+    type types[INODE_SEGMENT_SIZE];
+    InodeData data[INODE_SEGMENT_SIZE];
+} InodeSegment;
+#endif
 
 
 void insert_delay(int cycles);
 void inode_table_init();
 void inode_table_destroy();
+int inode_table_size();
 int inode_create(type nType);
 int inode_delete(int inumber);
 int inode_get(int inumber, type *nType, union Data *data);
+int inode_peek(int inumber, type *nType, union Data *data);
+int inode_rdlock(int inumber);
+int inode_wrlock(int inumber);
+int inode_tryrdlock(int inumber);
+int inode_trywrlock(int inumber);
+int inode_unlock(int inumber);
+int inode_set_capacity(int capacity);
+void inode_set_brlock_enabled(int enabled);
+void inode_set_locking(int enabled);
+void inode_use_brlock(int inumber);
+unsigned int inode_read_begin(int inumber);
+int inode_read_validate(int inumber, unsigned int version);
 int inode_set_file(int inumber, char *fileContents, int len);
-int dir_reset_entry(int inumber, int sub_inumber);
+int inode_read_file(int inumber, char *buffer, int len, long offset);
+int inode_write_file(int inumber, char *buffer, int len, long offset);
+int inode_write_file_shared(int inumber, char *buffer, int len, long offset);
+int inode_truncate_file(int inumber, long size);
+int inode_map_file(int inumber, int *fd);
+int inode_start_log(int inumber);
+int inode_append_file(int inumber, char *buffer, int len, long *offset, int *compact);
+int inode_compact_file(int inumber);
+int inode_open(int inumber);
+void inode_close(int inumber);
+int inode_open_count(int inumber);
+RangeLock *inode_ranges(int inumber);
+unsigned long *inode_renames(int inumber);
+int dir_reset_entry(int inumber, int sub_inumber, char *sub_name);
 int dir_add_entry(int inumber, int sub_inumber, char *sub_name);
 void inode_print_tree(FILE *fp, int inumber, char *name);
 
@@ -0,0 +1,33 @@
+#include "stats.h"
+
+typedef struct statsSlot {
+    unsigned long counters[NSTATS];
+} __attribute__((aligned(64))) StatsSlot;
+
+static StatsSlot slots[STATS_SLOTS];
+static int next_slot = 0;
+static __thread int thread_slot = -1;
+
+/*
+ * Adds to a counter in the calling thread's slot, so that threads don't
+ * share cache lines when counting.
+ * Input:
+ *  - counter: counter to update
+ *  - n: amount to add
+ */
+void stats_add(statCounter counter, unsigned long n) {
+    if (thread_slot == -1)
+        thread_slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) % STATS_SLOTS;
+    __atomic_fetch_add(&slots[thread_slot].counters[counter], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the total of a counter over all the slots.
+ */
+unsigned long stats_get(statCounter counter) {
+    unsigned long total = 0;
+
+    for (int i = 0; i < STATS_SLOTS; i++)
+        total += __atomic_load_n(&slots[i].counters[counter], __ATOMIC_RELAXED);
+    return total;
+}
@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/* threads are spread over this many counter slots, one cache line each */
+#define STATS_SLOTS 64
+
+/*
+ * Server statistics counters
+ */
+typedef enum statCounter {
+	STAT_BLOOM_NEGATIVE,       /* misses answered by the filters alone */
+	STAT_BLOOM_FALSE_POSITIVE, /* misses that still needed a scan */
+	STAT_BLOOM_TRUE_POSITIVE,  /* hits */
+	STAT_DIR_SPILLS,           /* directories moved from inline entries to stripes */
+	STAT_OPTIMISTIC_LOOKUP,    /* lookups resolved without locks */
+	STAT_OPTIMISTIC_RETRY,     /* optimistic lookups that saw a writer */
+	STAT_BRLOCK_SWITCHES,      /* i-nodes switched to big-reader locks */
+	STAT_RWLOCK_SLEEPS,        /* spin locks that gave up spinning */
+	STAT_RWLOCK_REVOCATIONS,   /* reader biases revoked by writers */
+	STAT_MOVE_RETRY,           /* moves walked again, see move */
+	STAT_MOVE_SHARED_COMPONENTS, /* components of common ancestors, see move_aux */
+	STAT_LOCKSET_TRY,          /* locks only tried to keep inumber order */
+	STAT_LOCKSET_BACKOFF,      /* of those, busy ones that restarted an operation */
+	STAT_RANGELOCK_WAITS,      /* byte-range locks that waited for an overlapping range */
+	STAT_SNAPSHOTS,            /* sealed copies of file contents made for file_map */
+	STAT_SNAPSHOT_BYTES,       /* bytes copied into them */
+	STAT_SNAPSHOT_SHARED,      /* maps served by a snapshot made for an earlier one */
+	STAT_APPLOG_BYTES,         /* bytes appended to file logs */
+	STAT_APPLOG_COMMIT_WAITS,  /* appends that waited for an earlier one to be published */
+	STAT_APPLOG_FOLDS,         /* times logs were folded into extents */
+	STAT_APPLOG_FOLDED_BYTES,  /* bytes they held */
+	STAT_RECLAIM_RETIRED,      /* callbacks deferred by reclaim_call */
+	STAT_RECLAIM_FREED,        /* deferred callbacks already run */
+	STAT_RECLAIM_LATENCY_US,   /* total time between retire and run */
+	STAT_SLAB_ALLOCS,          /* objects allocated by slab_alloc */
+	STAT_SLAB_FREES,           /* objects freed by slab_free */
+	STAT_SLAB_REFILLS,         /* thread caches refilled from a depot */
+	STAT_SLAB_FLUSHES,         /* thread caches that returned a batch to a depot */
+	STAT_SYSTEM_ALLOCS,        /* slab and extent regions, large objects and arena blocks taken from the system */
+	NSTATS
+} statCounter;
+
+
+void stats_add(statCounter counter, unsigned long n);
+unsigned long stats_get(statCounter counter);
+
+#endif /* STATS_H */
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "state.h"
+#include "sync.h"
+
+static char *strategy_names[NSYNCSTRATEGIES] = {"mutex", "rwlock", "inode", "optimistic"};
+
+static syncStrategy strategy = SYNC_OPTIMISTIC;
+
+/* SYNC_MUTEX and SYNC_RWLOCK */
+static pthread_mutex_t global_mutex;
+static pthread_rwlock_t global_rwlock;
+
+/*
+ * Finds the strategy with the given name.
+ * Returns: the strategy, or FAIL if there is none
+ */
+int sync_strategy_from_name(char *name) {
+    for (int i = 0; i < NSYNCSTRATEGIES; i++)
+        if (strcmp(name, strategy_names[i]) == 0)
+            return i;
+    return FAIL;
+}
+
+char *sync_strategy_name(int s) {
+    return strategy_names[s];
+}
+
+/*
+ * Chooses the strategy. Must be called before the file system is
+ * initialized.
+ */
+void sync_set_strategy(int s) {
+    strategy = s;
+}
+
+int sync_get_strategy() {
+    return strategy;
+}
+
+/*
+ * Initializes the global lock of the strategy, if it has one, and turns
+ * the i-node locks off if they are not needed.
+ */
+void sync_init() {
+    inode_set_locking(strategy == SYNC_INODE || strategy == SYNC_OPTIMISTIC);
+
+    switch (strategy) {
+        case SYNC_MUTEX:
+            if (pthread_mutex_init(&global_mutex, NULL) != 0) {
+                fprintf(stderr, "Error: failed to initialize mutex\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case SYNC_RWLOCK:
+            if (pthread_rwlock_init(&global_rwlock, NULL) != 0) {
+                fprintf(stderr, "Error: failed to initialize rwlock\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void sync_destroy() {
+    switch (strategy) {
+        case SYNC_MUTEX:
+            if (pthread_mutex_destroy(&global_mutex) != 0) {
+                fprintf(stderr, "Error: failed to destroy mutex\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case SYNC_RWLOCK:
+            if (pthread_rwlock_destroy(&global_rwlock) != 0) {
+                fprintf(stderr, "Error: failed to destroy rwlock\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Takes the global lock of the strategy, if it has one, for a whole
+ * operation.
+ * Input:
+ *  - write: FALSE if the operation doesn't change the file system
+ */
+void sync_lock(int write) {
+    switch (strategy) {
+        case SYNC_MUTEX:
+            if (pthread_mutex_lock(&global_mutex) != 0) {
+                fprintf(stderr, "Error: failed to lock mutex\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case SYNC_RWLOCK:
+            if ((write ? pthread_rwlock_wrlock(&global_rwlock) : pthread_rwlock_rdlock(&global_rwlock)) != 0) {
+                fprintf(stderr, "Error: failed to lock rwlock\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void sync_unlock() {
+    switch (strategy) {
+        case SYNC_MUTEX:
+            if (pthread_mutex_unlock(&global_mutex) != 0) {
+                fprintf(stderr, "Error: failed to unlock mutex\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case SYNC_RWLOCK:
+            if (pthread_rwlock_unlock(&global_rwlock) != 0) {
+                fprintf(stderr, "Error: failed to unlock rwlock\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+/*
+ * How the operations are synchronized, chosen at startup:
+ *  - SYNC_MUTEX: one global mutex around every operation
+ *  - SYNC_RWLOCK: one global rwlock, read locked by lookups, prints and
+ *    file reads and writes that share the file (see file_write)
+ *  - SYNC_INODE: a lock per i-node, every lookup locks its path
+ *  - SYNC_OPTIMISTIC: a lock per i-node, lookups first try the dentry
+ *    cache and a walk without locks (see lookup)
+ * With a global lock the i-node locks are not taken at all.
+ */
+typedef enum syncStrategy {
+	SYNC_MUTEX,
+	SYNC_RWLOCK,
+	SYNC_INODE,
+	SYNC_OPTIMISTIC,
+	NSYNCSTRATEGIES
+} syncStrategy;
+
+
+int sync_strategy_from_name(char *name);
+char *sync_strategy_name(int strategy);
+void sync_set_strategy(int strategy);
+int sync_get_strategy();
+void sync_init();
+void sync_destroy();
+void sync_lock(int write);
+void sync_unlock();
+
+#endif /* SYNC_H */
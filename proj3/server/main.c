@@ -1,11 +1,14 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include "fs/operations.h"
+#include "fs/session.h"
 
-#define MAX_INPUT_SIZE 100
 #define FALSE 0
 #define TRUE 1
 
@@ -17,19 +20,32 @@ int sockfd;
  * Receives a command and executes it
  * Input:
  *   - command
+ *   - client: name of the client that sent it, see clientName
+ *   - data: what follows the command, the data of a write
+ *   - len: length of data
+ *   - reply: receives the data of a read
+ *   - reply_len: receives the length of the data in reply
+ *   - reply_fd: receives a descriptor to pass to the client, or -1
  * Returns:
- *   - SUCCESS or FAIL
+ *   - SUCCESS or FAIL, a descriptor for an open, the number of bytes
+ *     read or written for a read or write and the size of the file for a
+ *     map
  */
-int applyCommand(char *command) {
+int applyCommand(char *command, char *client, char *data, int len, char *reply, int *reply_len, int *reply_fd) {
     char token, type;
-    char name[MAX_INPUT_SIZE], dest[MAX_INPUT_SIZE];
+    char name[MAX_INPUT_SIZE] = "", dest[MAX_INPUT_SIZE] = "";
     int res, numTokens = sscanf(command, "%c %s %s", &token, name, dest);
     
     type = dest[0];
-
-    if (numTokens < 2) {
-        fprintf(stderr, "Error: invalid command in Queue\n");
-        exit(EXIT_FAILURE);
+    *reply_len = 0;
+    *reply_fd = -1;
+
+    /* mount and unmount are the only commands without arguments, and create,
+     * move, open, read and truncate the ones with two; clients may send anything */
+    if (numTokens < 1 || (numTokens < 2 && token != 'n' && token != 'u') ||
+        (numTokens < 3 && token && strchr("cmort", token))) {
+        fprintf(stderr, "Error: invalid command\n");
+        return FAIL;
     }
 
     switch (token) {
@@ -67,6 +83,49 @@ int applyCommand(char *command) {
             res = print_tecnicofs_tree(name);
             printf("Tecnicofs tree printed to %s\n", name);
             break;
+        case 's':
+            res = print_tecnicofs_stats(name);
+            printf("Tecnicofs stats printed to %s\n", name);
+            break;
+        case 'o':
+            res = session_open(client, name, atoi(dest));
+            printf("Open: %s\n", name);
+            break;
+        case 'x':
+            res = session_close(client, atoi(name));
+            printf("Close: descriptor %s\n", name);
+            break;
+        case 'r': {
+            int max = atoi(dest);
+
+            res = session_read(client, atoi(name), reply, max < MAX_IO_SIZE ? max : MAX_IO_SIZE);
+            if (res > 0)
+                *reply_len = res;
+            printf("Read: descriptor %s\n", name);
+            break;
+        }
+        case 'w':
+            res = session_write(client, atoi(name), data, len);
+            printf("Write: descriptor %s\n", name);
+            break;
+        case 't':
+            res = session_truncate(client, atoi(name), atol(dest));
+            printf("Truncate: descriptor %s to %s\n", name, dest);
+            break;
+        case 'g':
+            res = session_map(client, atoi(name), reply_fd);
+            printf("Map: descriptor %s\n", name);
+            break;
+        case 'n':
+            /* a client that exited without unmounting may have left its
+             * files open under the same name */
+            res = session_end(client);
+            printf("Mount\n");
+            break;
+        case 'u':
+            res = session_end(client);
+            printf("Unmount\n");
+            break;
         default: { /* error */
             fprintf(stderr, "Error: command to apply\n");
             res = FAIL;
@@ -96,25 +155,94 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) {
 }
 
 /*
- * Infinite loop: gets a command from the client, executes it and returns its result
+ * Names a client after the address of its socket. Sockets the client didn't
+ * name are bound to an abstract address, which starts with '\0' and is
+ * written with '@' instead.
+ * Inputs:
+ *   - addr, addrlen: address of the client socket
+ *   - name: receives the name, at least MAX_CLIENT_NAME bytes
+ */
+void clientName(struct sockaddr_un *addr, socklen_t addrlen, char *name) {
+    size_t len = addrlen > offsetof(struct sockaddr_un, sun_path) ?
+        addrlen - offsetof(struct sockaddr_un, sun_path) : 0;
+
+    if (len >= MAX_CLIENT_NAME)
+        len = MAX_CLIENT_NAME - 1;
+    memcpy(name, addr->sun_path, len);
+    name[len] = '\0';
+    if (len > 0 && name[0] == '\0')
+        name[0] = '@';
+}
+
+/*
+ * Sends a reply to a client, with a descriptor attached as SCM_RIGHTS
+ * ancillary data. The client receives a new descriptor of the same open
+ * file, and the server's copy is closed.
+ * Inputs:
+ *   - reply, len: the reply
+ *   - fd: descriptor to pass, or -1 for none
+ *   - addr, addrlen: address of the client socket
+ * Returns:
+ *   - the result of sendmsg
+ */
+int sendReply(char *reply, int len, int fd, struct sockaddr_un *addr, socklen_t addrlen) {
+    struct iovec iov = { .iov_base = reply, .iov_len = len };
+    struct msghdr msg = { .msg_name = addr, .msg_namelen = addrlen, .msg_iov = &iov, .msg_iovlen = 1 };
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    int res;
+
+    if (fd >= 0) {
+        struct cmsghdr *cmsg;
+
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    res = sendmsg(sockfd, &msg, 0);
+    if (fd >= 0)
+        close(fd);
+    return res;
+}
+
+/*
+ * Infinite loop: gets a command from the client, executes it and returns its result.
+ * Commands take the first MAX_INPUT_SIZE bytes of a request, the data of a
+ * write follows them. Replies start with the result, followed by the data
+ * of a read; a map passes the descriptor of a snapshot along instead.
  */
 void *processInput(void* arg) {
-    socklen_t addrlen = sizeof(struct sockaddr_un);
-    size_t output_size = sizeof(int);
+    socklen_t addrlen;
     struct sockaddr_un client_addr;
-    char in_buffer[MAX_INPUT_SIZE];
-    int c, output;
+    char in_buffer[MAX_INPUT_SIZE + MAX_IO_SIZE], out_buffer[sizeof(int) + MAX_IO_SIZE];
+    char client[MAX_CLIENT_NAME];
+    int c, output, reply_len, reply_fd;
 
     while (TRUE) {
-        c = recvfrom(sockfd, in_buffer, sizeof(in_buffer) - 1, 0, (struct sockaddr*)&client_addr, &addrlen);
+        addrlen = sizeof(struct sockaddr_un);
+        c = recvfrom(sockfd, in_buffer, sizeof(in_buffer), 0, (struct sockaddr*)&client_addr, &addrlen);
         if (c <= 0) continue;
 
-        /* in case the client doesn't end the message with '\0' */
-        in_buffer[c] = '\0';
+        /* in case the client doesn't end the command with '\0' */
+        in_buffer[c < MAX_INPUT_SIZE ? c : MAX_INPUT_SIZE - 1] = '\0';
+        clientName(&client_addr, addrlen, client);
 
-        output = applyCommand(in_buffer);
+        output = applyCommand(in_buffer, client, in_buffer + MAX_INPUT_SIZE,
+                              c > MAX_INPUT_SIZE ? c - MAX_INPUT_SIZE : 0, out_buffer + sizeof(int), &reply_len, &reply_fd);
+        arena_reset();
 
-        sendto(sockfd, &output, output_size, 0, (struct sockaddr*)&client_addr, addrlen);
+        memcpy(out_buffer, &output, sizeof(int));
+        /* the client exited without unmounting, close what it left open */
+        if (sendReply(out_buffer, sizeof(int) + reply_len, reply_fd, &client_addr, addrlen) < 0 &&
+            (errno == ECONNREFUSED || errno == ENOENT))
+            session_end(client);
 
         if (output == ABORT) exit(EXIT_FAILURE);
     }
@@ -160,14 +288,56 @@ void join_threads() {
 }
 
 
+/*
+ * Applies the options that follow the mandatory arguments
+ * Input:
+ *   - argc, argv: the arguments of main, options start at argv[3]
+ * Returns:
+ *   - SUCCESS or FAIL if an option is invalid
+ */
+int parseOptions(int argc, char *argv[]) {
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--lock") == 0 && i + 1 < argc) {
+            int kind = rwlock_kind_from_name(argv[++i]);
+
+            if (kind == FAIL) {
+                fprintf(stderr, "Error: unknown lock %s\n", argv[i]);
+                return FAIL;
+            }
+            rwlock_set_kind(kind);
+        }
+        else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc) {
+            int strategy = sync_strategy_from_name(argv[++i]);
+
+            if (strategy == FAIL) {
+                fprintf(stderr, "Error: unknown sync strategy %s\n", argv[i]);
+                return FAIL;
+            }
+            sync_set_strategy(strategy);
+        }
+        else if (strcmp(argv[i], "--inodes") == 0 && i + 1 < argc) {
+            if (inode_set_capacity(atoi(argv[++i])) != SUCCESS) {
+                fprintf(stderr, "Error: invalid i-node capacity %s\n", argv[i]);
+                return FAIL;
+            }
+        }
+        else {
+            fprintf(stderr, "Error: invalid option %s\n", argv[i]);
+            return FAIL;
+        }
+    }
+    return SUCCESS;
+}
+
 int main(int argc, char* argv[]) {
     struct sockaddr_un server_addr;
     socklen_t addrlen;
     char *path;
 
-    if (argc != 3) {
+    if (argc < 3 || parseOptions(argc, argv) != SUCCESS) {
         fprintf(stderr,"Error : Invalid input.\n");
-        fprintf(stderr, "Input should be:\n./tecnicofs numthreads socketname\n");
+        fprintf(stderr, "Input should be:\n./tecnicofs numthreads socketname [--lock pthread|spin|fair|biased]\n"
+                        "    [--sync mutex|rwlock|inode|optimistic] [--inodes capacity]\n");
         exit(EXIT_FAILURE);
     }
 
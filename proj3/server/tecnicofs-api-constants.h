@@ -3,10 +3,15 @@
 #define TECNICOFS_API_CONSTANTS_H
 
 #define MAX_FILE_NAME 100
-#define MAX_INPUT_SIZE 100
+/* bytes of a request that hold the command and its paths, the server sizes
+ * the paths it copies from their length */
+#define MAX_INPUT_SIZE 4096
+/* data carried by one read or write request, after the command */
+#define MAX_IO_SIZE (64 * 1024)
 
 
-typedef enum permission { NONE, WRITE, READ, RW } permission;
+/* APPEND is added to WRITE or RW, to have every write go to the end */
+typedef enum permission { NONE, WRITE, READ, RW, APPEND } permission;
 typedef enum type { T_FILE, T_DIRECTORY, T_NONE } type;
 
 /* Client already has an open session with a TecnicoFS server */